@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+
+#include "settings.h"
+#include "particle_system/particle_system.h"
+
+/*
+	Headless run
+- steps a population without opening a window or touching any graphics, for machines with no display
+- "pps --headless <steps> [particle count] [world scale] [grid cells x] [grid cells y]", the population is configured
+  as for a windowed run, see PopulationConfig::from_arguments
+- reports the time per step, and the state hash at the end. with deterministic set the hash can be compared between runs
+*/
+
+
+inline int run_headless(const PopulationConfig& config, const size_t steps)
+{
+	ParticlePopulation population(config);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < steps; ++i)
+	{
+		population.step();
+	}
+	const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << "[INFO]: " << steps << " steps of " << population.particle_count() << " particles in " << elapsed.count() << " ms, "
+		<< (steps > 0 ? elapsed.count() / static_cast<double>(steps) : 0.0) << " ms per step\n";
+	std::cout << "[INFO]: state hash after " << population.iterations() << " iterations: " << std::hex
+		<< population.state_hash() << std::dec << '\n';
+	return 0;
+}
@@ -1,9 +1,20 @@
+#include <cstring>
+#include <string>
+
+#include "headless.h"
 #include "simulation.h"
 
 
-int main()
+int main(int argc, char** argv)
 {
-	Simulation simulation;
+	// "pps --headless <steps> [particle count] ..." steps the population without opening a window, see headless.h
+	if (argc > 2 && std::strcmp(argv[1], "--headless") == 0)
+	{
+		return run_headless(PopulationConfig::from_arguments(argc - 2, argv + 2), std::stoull(argv[2]));
+	}
+
+	// "pps [particle count] [world scale] [grid cells x] [grid cells y]", see PopulationConfig::from_arguments
+	Simulation simulation(PopulationConfig::from_arguments(argc, argv));
 	simulation.run();
 }
 
@@ -1,62 +1,69 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
-#include <SFML/Graphics.hpp>
+#include <span>
+#include "particle_store.h"
 #include "../utils/spatial_grid.h"
 
-template<size_t max_beacons, int grid_cells_x, int grid_cells_y>
+template<size_t max_beacons>
 class Beacons
 {
 	std::array<size_t, max_beacons> beacons_ = {};
 	size_t beacons_size_ = 0;
 
 	// information for finding beacon candidates
-	SpatialGrid<grid_cells_x, grid_cells_y>& spatial_grid_;
-	std::vector<float>& positions_x_;
-	std::vector<float>& positions_y_;
+	SpatialGrid& spatial_grid_;
+	const ParticleStore& particles_;
 
-	const float cell_size_ = 0.f;
 	const float world_width_ = 0.f;
 	const float world_height_ = 0.f;
 
 public:
-	Beacons(SpatialGrid<grid_cells_x, grid_cells_y>& spatial_grid, std::vector<float>& positions_x, std::vector<float>& positions_y,
-		const float cell_size, const float world_width, const float world_height)
-		: spatial_grid_(spatial_grid), positions_x_(positions_x), positions_y_(positions_y), cell_size_(cell_size), world_width_(world_width), world_height_(world_height)
+	Beacons(SpatialGrid& spatial_grid, const ParticleStore& particles, const float world_width, const float world_height)
+		: spatial_grid_(spatial_grid), particles_(particles), world_width_(world_width), world_height_(world_height)
 	{
 
 	}
 
-	void add_beacons(const sf::Vector2f& position, const float radius)
+	// marking the particles within radius of (x, y), up to max_beacons of them
+	void add_beacons(const float x, const float y, const float radius)
 	{
 		beacons_size_ = 0;
 
-		const bool out_of_bounds = position.x <= cell_size_ || position.y <= cell_size_ || position.x >= world_width_ - cell_size_ || position.y >= world_height_ - cell_size_;
+		// the grid resolution can change at runtime, so the cells to search are worked out from the current cell size
+		const float cell_size = spatial_grid_.m_cellSize.x;
+		const int reach = std::max(1, static_cast<int>(std::ceil(radius / cell_size)));
+		const float margin = cell_size * static_cast<float>(reach);
+		const bool out_of_bounds = x <= margin || y <= margin || x >= world_width_ - margin || y >= world_height_ - margin;
 
 		if (out_of_bounds)
 			return;
 
 		// getting the cell at position
-		const cell_idx cell_index = spatial_grid_.hash(position.x, position.y);
+		const cell_idx cell_index = spatial_grid_.hash(x, y);
+		const cell_idx grid_cells_x = spatial_grid_.cells_x;
 		const int cell_index_x = cell_index % grid_cells_x;
 		const int cell_index_y = cell_index / grid_cells_x;
 
 		// iterating over every neighbouring cell
-		for (cell_idx neighbour_index_x = cell_index_x - 1; neighbour_index_x <= cell_index_x + 1; ++neighbour_index_x)
+		for (int neighbour_index_x = cell_index_x - reach; neighbour_index_x <= cell_index_x + reach; ++neighbour_index_x)
 		{
-			for (cell_idx neighbour_index_y = cell_index_y - 1; neighbour_index_y <= cell_index_y + 1; ++neighbour_index_y)
+			for (int neighbour_index_y = cell_index_y - reach; neighbour_index_y <= cell_index_y + reach; ++neighbour_index_y)
 			{
-				const cell_idx neighbour_index = neighbour_index_y * grid_cells_x + neighbour_index_x;
-				const auto& neighbour_container = spatial_grid_.grid[neighbour_index];
+				const cell_idx neighbour_index = static_cast<cell_idx>(neighbour_index_y) * grid_cells_x + static_cast<cell_idx>(neighbour_index_x);
+				const obj_idx* neighbour_container = spatial_grid_.cell_contents(neighbour_index);
 				const auto neighbour_size = spatial_grid_.objects_count[neighbour_index];
 
 				// iterating over every object per neighbour_cell
-				for (auto container_index = 0; container_index < neighbour_size; ++container_index)
+				for (uint32_t container_index = 0; container_index < neighbour_size; ++container_index)
 				{
 					const obj_idx index = neighbour_container[container_index];
-					const sf::Vector2f particle_pos = { positions_x_[index], positions_y_[index] };
-					const sf::Vector2f dir = particle_pos - position;
-					const float dist = dir.x * dir.x + dir.y * dir.y;
+					const float dir_x = particles_.positions_x[index] - x;
+					const float dir_y = particles_.positions_y[index] - y;
+					const float dist = dir_x * dir_x + dir_y * dir_y;
 
 					if (dist < radius * radius)
 					{
@@ -72,21 +79,24 @@ public:
 		}
 	}
 
-	void render(sf::RenderWindow& window)
+	// keeps the beacons on the same particles after the particle arrays have been permuted, beacons on removed particles are dropped
+	void remap(const std::vector<obj_idx>& new_index_of)
 	{
-		const float rad = PPS_Settings::particle_radius;
-
-		sf::CircleShape beacon_body;
-		beacon_body.setFillColor({ 255, 255, 255 });
-		beacon_body.setRadius(rad);
-
-		for (int beacon_container_index = 0; beacon_container_index < beacons_size_; ++beacon_container_index)
+		size_t kept = 0;
+		for (size_t i = 0; i < beacons_size_; ++i)
 		{
-			int beacon_index = beacons_[beacon_container_index];
-
-			const sf::Vector2f position = { positions_x_[beacon_index] - rad, positions_y_[beacon_index] - rad };
-			beacon_body.setPosition(position);
-			window.draw(beacon_body);
+			const obj_idx new_index = new_index_of[beacons_[i]];
+			if (new_index != ParticleStore::no_particle)
+			{
+				beacons_[kept++] = new_index;
+			}
 		}
+		beacons_size_ = kept;
+	}
+
+	// the indices of the particles marked as beacons, for the renderer
+	std::span<const size_t> particles() const
+	{
+		return { beacons_.data(), beacons_size_ };
 	}
 };
\ No newline at end of file
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../utils/spatial_grid.h"
+#include "../utils/thread_pool.h"
+
+/*
+	CellResidentStorage
+- an alternative to indexing flat particle arrays through the spatial grid: the particles live inside the grid cells
+- every cell owns a fixed-width SoA block holding x, y and heading directly. dense cells chain extra overflow blocks
+- particles only move between blocks when they cross a cell boundary, in migrate()
+- neighbour coordinates are copied straight out of the blocks, there is no indirection through obj_idx
+- each particle keeps its original index as an id, so the flat arrays used by the renderer can be refreshed with export_to()
+*/
+
+
+template<size_t BlockWidth>
+class CellResidentStorage
+{
+public:
+	inline static constexpr int32_t no_block = -1;
+
+	struct CellBlock
+	{
+		alignas(32) float x[BlockWidth];
+		alignas(32) float y[BlockWidth];
+		alignas(32) uint16_t heading[BlockWidth];
+		obj_idx id[BlockWidth];
+		uint16_t neighbours[BlockWidth];
+		int32_t next = no_block; // the overflow block chained after this one
+	};
+
+	// the slot of a particle inside a cell's chain of blocks
+	struct Slot
+	{
+		CellBlock* block;
+		uint32_t offset;
+	};
+
+	bool loaded() const
+	{
+		return !blocks_.empty();
+	}
+
+	uint32_t cell_size(const cell_idx cell_index) const
+	{
+		return cell_sizes_[cell_index];
+	}
+
+	uint32_t max_cell_size() const
+	{
+		return *std::max_element(cell_sizes_.begin(), cell_sizes_.end());
+	}
+
+	CellBlock& head(const cell_idx cell_index)
+	{
+		return blocks_[cell_index];
+	}
+
+	CellBlock* next(const CellBlock& block)
+	{
+		return block.next == no_block ? nullptr : &blocks_[block.next];
+	}
+
+
+	// moving every particle into the block of the cell it is in. the positions must already be inside the world.
+	// also used to start over after the grid was resized
+	void load(const SpatialGrid& grid, const float* positions_x, const float* positions_y,
+		const uint16_t* headings, const uint16_t* neighbour_counts, const size_t particle_count)
+	{
+		total_cells_ = grid.total_cells;
+		blocks_.assign(total_cells_, CellBlock{});
+		cell_sizes_.assign(total_cells_, 0);
+
+		for (size_t i = 0; i < particle_count; ++i)
+		{
+			insert(grid.hash(positions_x[i], positions_y[i]), positions_x[i], positions_y[i], headings[i],
+				static_cast<obj_idx>(i), neighbour_counts[i]);
+		}
+	}
+
+
+	// appending the coordinates of every particle in a cell to the neighbour buffers, one contiguous run per block.
+	// the shift moves them by whole world sizes when the cell is seen across the world edge
+	void append_cell(const cell_idx cell_index, float* n_positions_x, float* n_positions_y, int& neighbours_size,
+		const float shift_x = 0.f, const float shift_y = 0.f) const
+	{
+		uint32_t remaining = cell_sizes_[cell_index];
+		const CellBlock* block = &blocks_[cell_index];
+
+		while (remaining > 0)
+		{
+			const uint32_t count = std::min<uint32_t>(remaining, BlockWidth);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				n_positions_x[neighbours_size + i] = block->x[i] + shift_x;
+				n_positions_y[neighbours_size + i] = block->y[i] + shift_y;
+			}
+			neighbours_size += static_cast<int>(count);
+			remaining -= count;
+			block = block->next == no_block ? nullptr : &blocks_[block->next];
+		}
+	}
+
+
+	// wrapping every particle back into the world and moving the ones whose cell changed into their new cell's block
+	void migrate(const SpatialGrid& grid, const float world_width, const float world_height, tp::ThreadPool& thread_pool)
+	{
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const uint32_t cells_per_thread = static_cast<uint32_t>(total_cells_) / thread_count;
+		outboxes_.resize(thread_count);
+
+		// every thread owns a range of cells, so removing from a block never races. leavers are collected per thread
+		thread_pool.parallel([this, thread_count, cells_per_thread, &grid, world_width, world_height](const uint32_t t) {
+			std::vector<Migrant>& outbox = outboxes_[t];
+			outbox.clear();
+
+			const uint32_t start = t * cells_per_thread;
+			const uint32_t end = (t == thread_count - 1) ? static_cast<uint32_t>(total_cells_) : start + cells_per_thread;
+
+			for (uint32_t cell_index = start; cell_index < end; ++cell_index)
+			{
+				uint32_t offset = 0;
+				while (offset < cell_sizes_[cell_index])
+				{
+					const Slot slot = slot_at(cell_index, offset);
+					float& x = slot.block->x[slot.offset];
+					float& y = slot.block->y[slot.offset];
+
+					x -= world_width * std::floor(x / world_width);
+					y -= world_height * std::floor(y / world_height);
+
+					const cell_idx new_cell = grid.hash(x, y);
+					if (new_cell == cell_index)
+					{
+						++offset;
+						continue;
+					}
+
+					outbox.push_back({ new_cell, x, y, slot.block->heading[slot.offset], slot.block->id[slot.offset], slot.block->neighbours[slot.offset] });
+					remove(cell_index, offset);
+				}
+			}
+			});
+
+		// arrivals are inserted on one thread, only the few particles that crossed a boundary get here
+		for (const std::vector<Migrant>& outbox : outboxes_)
+		{
+			for (const Migrant& migrant : outbox)
+			{
+				insert(migrant.cell, migrant.x, migrant.y, migrant.heading, migrant.id, migrant.neighbours);
+			}
+		}
+	}
+
+
+	// writing every particle back to the flat arrays at its original index
+	void export_to(float* positions_x, float* positions_y, uint16_t* headings, uint16_t* neighbour_counts, tp::ThreadPool& thread_pool)
+	{
+		thread_pool.dispatch(static_cast<uint32_t>(total_cells_), [&](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t cell_index = start; cell_index < end; ++cell_index)
+			{
+				uint32_t remaining = cell_sizes_[cell_index];
+				for (CellBlock* block = &blocks_[cell_index]; remaining > 0; block = next(*block))
+				{
+					const uint32_t count = std::min<uint32_t>(remaining, BlockWidth);
+					for (uint32_t i = 0; i < count; ++i)
+					{
+						const obj_idx id = block->id[i];
+						positions_x[id] = block->x[i];
+						positions_y[id] = block->y[i];
+						headings[id] = block->heading[i];
+						neighbour_counts[id] = block->neighbours[i];
+					}
+					remaining -= count;
+				}
+			}
+		});
+	}
+
+
+private:
+	struct Migrant
+	{
+		cell_idx cell;
+		float x, y;
+		uint16_t heading;
+		obj_idx id;
+		uint16_t neighbours;
+	};
+
+	Slot slot_at(const cell_idx cell_index, uint32_t offset)
+	{
+		CellBlock* block = &blocks_[cell_index];
+		while (offset >= BlockWidth)
+		{
+			block = &blocks_[block->next];
+			offset -= BlockWidth;
+		}
+		return { block, offset };
+	}
+
+	void insert(const cell_idx cell_index, const float x, const float y, const uint16_t heading, const obj_idx id, const uint16_t neighbours)
+	{
+		uint32_t& size = cell_sizes_[cell_index];
+
+		// chaining a new overflow block when every block of the cell is full. empty blocks stay chained for reuse
+		if (size > 0 && size % BlockWidth == 0)
+		{
+			CellBlock& last = *slot_at(cell_index, size - 1).block;
+			if (last.next == no_block)
+			{
+				const auto new_block = static_cast<int32_t>(blocks_.size());
+				blocks_.emplace_back();
+				slot_at(cell_index, size - 1).block->next = new_block; // emplace_back may have moved the blocks
+			}
+		}
+
+		const Slot slot = slot_at(cell_index, size);
+		slot.block->x[slot.offset] = x;
+		slot.block->y[slot.offset] = y;
+		slot.block->heading[slot.offset] = heading;
+		slot.block->id[slot.offset] = id;
+		slot.block->neighbours[slot.offset] = neighbours;
+		++size;
+	}
+
+	// swap-remove: the last particle of the cell fills the hole
+	void remove(const cell_idx cell_index, const uint32_t offset)
+	{
+		uint32_t& size = cell_sizes_[cell_index];
+		const Slot hole = slot_at(cell_index, offset);
+		const Slot last = slot_at(cell_index, size - 1);
+
+		hole.block->x[hole.offset] = last.block->x[last.offset];
+		hole.block->y[hole.offset] = last.block->y[last.offset];
+		hole.block->heading[hole.offset] = last.block->heading[last.offset];
+		hole.block->id[hole.offset] = last.block->id[last.offset];
+		hole.block->neighbours[hole.offset] = last.block->neighbours[last.offset];
+		--size;
+	}
+
+	// blocks_[0, total_cells_) are the head block of each cell, overflow blocks are appended after them
+	size_t total_cells_ = 0;
+	std::vector<CellBlock> blocks_{};
+	std::vector<uint32_t> cell_sizes_{};
+
+	// particles leaving their cell during a migration, one list per thread
+	std::vector<std::vector<Migrant>> outboxes_{};
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+#include "neighbour_kernel.h"
+
+#include "../settings.h"
+
+/*
+	HeadingTrig
+- evaluates the sin and cos of a 16-bit binary angle heading, where a full turn is 65536
+- TrigMode::table256: the heading's top 8 bits index a 256 entry table, about 1.4 degrees per entry
+- TrigMode::interpolated_table: the top 10 bits index a 1024 entry table and the low 6 bits interpolate between two entries
+- TrigMode::polynomial: the heading is folded into [-pi/4, pi/4] and evaluated with minimax polynomials. there are no
+  lookups and no branches, so the move pass runs 8 particles at a time with AVX2
+- the Q14 versions feed the fixed-point neighbour kernel
+*/
+
+
+struct SinCos
+{
+	float sin;
+	float cos;
+};
+
+struct FixedSinCos
+{
+	int16_t sin;
+	int16_t cos;
+};
+
+// moves `count` particles `step` along their headings, in place
+using advance_fn = void(*)(float* positions_x, float* positions_y, const uint16_t* headings, uint32_t count, float step);
+
+
+// the polynomials of TrigMode::polynomial, on an angle within [-pi/4, pi/4]
+inline constexpr float sin_coefficients[3] = { -1.6666654611e-1f, 8.3321608736e-3f, -1.9515295891e-4f };
+inline constexpr float cos_coefficients[3] = { 4.166664568298827e-2f, -1.388731625493765e-3f, 2.443315711809948e-5f };
+inline constexpr float radians_per_binary_angle = 6.283185307179586f / 65536.f;
+
+
+inline SinCos polynomial_sin_cos(const uint16_t heading)
+{
+	// the quadrant is the nearest multiple of a quarter turn, what is left over lies within an eighth of a turn of it
+	const uint32_t shifted = static_cast<uint32_t>(heading) + 0x2000u;
+	const uint32_t quadrant = (shifted >> 14) & 3u;
+	const float x = static_cast<float>(static_cast<int32_t>(shifted & 0x3FFFu) - 0x2000) * radians_per_binary_angle;
+	const float z = x * x;
+
+	// minimax polynomials, the same coefficients as the cephes sinf / cosf
+	const float s = x + x * z * (sin_coefficients[0] + z * (sin_coefficients[1] + z * sin_coefficients[2]));
+	const float c = 1.f - 0.5f * z + z * z * (cos_coefficients[0] + z * (cos_coefficients[1] + z * cos_coefficients[2]));
+
+	// rotating by the quadrant: odd quadrants swap sin and cos, and the sign bits are flipped following the quadrant's bits.
+	// done with bit masks rather than branches, a random quadrant per particle would mispredict half the time
+	const uint32_t swap_mask = 0u - (quadrant & 1u);
+	const uint32_t s_bits = std::bit_cast<uint32_t>(s);
+	const uint32_t c_bits = std::bit_cast<uint32_t>(c);
+	const uint32_t sin_bits = ((c_bits & swap_mask) | (s_bits & ~swap_mask)) ^ ((quadrant & 2u) << 30);
+	const uint32_t cos_bits = ((s_bits & swap_mask) | (c_bits & ~swap_mask)) ^ (((quadrant + 1u) & 2u) << 30);
+	return { std::bit_cast<float>(sin_bits), std::bit_cast<float>(cos_bits) };
+}
+
+
+inline void advance_polynomial_scalar(float* positions_x, float* positions_y, const uint16_t* headings, const uint32_t count, const float step)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const SinCos direction = polynomial_sin_cos(headings[i]);
+		positions_x[i] += step * direction.cos;
+		positions_y[i] += step * direction.sin;
+	}
+}
+
+
+PPS_TARGET_AVX2 inline void advance_polynomial_avx2(float* positions_x, float* positions_y, const uint16_t* headings, const uint32_t count, const float step)
+{
+	const __m256i quarter_offset = _mm256_set1_epi32(0x2000);
+	const __m256i remainder_mask = _mm256_set1_epi32(0x3FFF);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i two = _mm256_set1_epi32(2);
+	const __m256i three = _mm256_set1_epi32(3);
+	const __m256 to_radians = _mm256_set1_ps(radians_per_binary_angle);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 unit = _mm256_set1_ps(1.f);
+	const __m256 step_length = _mm256_set1_ps(step);
+
+	// the same steps as polynomial_sin_cos, 8 headings at a time
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i shifted = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(headings + i))), quarter_offset);
+		const __m256i quadrant = _mm256_and_si256(_mm256_srli_epi32(shifted, 14), three);
+		const __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(shifted, remainder_mask), quarter_offset)), to_radians);
+		const __m256 z = _mm256_mul_ps(x, x);
+
+		__m256 s = _mm256_add_ps(_mm256_set1_ps(sin_coefficients[1]), _mm256_mul_ps(z, _mm256_set1_ps(sin_coefficients[2])));
+		s = _mm256_add_ps(_mm256_set1_ps(sin_coefficients[0]), _mm256_mul_ps(z, s));
+		s = _mm256_add_ps(x, _mm256_mul_ps(_mm256_mul_ps(x, z), s));
+
+		__m256 c = _mm256_add_ps(_mm256_set1_ps(cos_coefficients[1]), _mm256_mul_ps(z, _mm256_set1_ps(cos_coefficients[2])));
+		c = _mm256_add_ps(_mm256_set1_ps(cos_coefficients[0]), _mm256_mul_ps(z, c));
+		c = _mm256_add_ps(_mm256_sub_ps(unit, _mm256_mul_ps(half, z)), _mm256_mul_ps(_mm256_mul_ps(z, z), c));
+
+		const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, one), one));
+		const __m256 sin_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, two), 30));
+		const __m256 cos_sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, one), two), 30));
+		const __m256 sin_value = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), sin_sign);
+		const __m256 cos_value = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), cos_sign);
+
+		_mm256_storeu_ps(positions_x + i, _mm256_add_ps(_mm256_loadu_ps(positions_x + i), _mm256_mul_ps(step_length, cos_value)));
+		_mm256_storeu_ps(positions_y + i, _mm256_add_ps(_mm256_loadu_ps(positions_y + i), _mm256_mul_ps(step_length, sin_value)));
+	}
+
+	advance_polynomial_scalar(positions_x + i, positions_y + i, headings + i, count - i, step);
+}
+
+
+class HeadingTrig
+{
+public:
+	inline static constexpr int table_size = 256;
+	inline static constexpr int table_shift = 8; // 65536 >> table_shift == table_size
+
+	inline static constexpr int fine_table_size = 1024;
+	inline static constexpr int fine_table_shift = 6;
+	inline static constexpr float fine_fraction_scale = 1.f / (1 << fine_table_shift);
+
+
+	HeadingTrig()
+	{
+		advance_polynomial_ = cpu_supports_avx2() ? &advance_polynomial_avx2 : &advance_polynomial_scalar;
+
+		constexpr double turn = 6.283185307179586476925286766559;
+
+		for (int i = 0; i < table_size; ++i)
+		{
+			const float angle = (i / static_cast<float>(table_size)) * static_cast<float>(turn);
+			sin_table_[i] = std::sin(angle);
+			cos_table_[i] = std::cos(angle);
+			fixed_sin_table_[i] = static_cast<int16_t>(std::lround(sin_table_[i] * fixed_trig_scale));
+			fixed_cos_table_[i] = static_cast<int16_t>(std::lround(cos_table_[i] * fixed_trig_scale));
+		}
+
+		// one extra entry so the last interval interpolates towards a full turn without wrapping the index
+		for (int i = 0; i <= fine_table_size; ++i)
+		{
+			const double angle = turn * i / fine_table_size;
+			fine_sin_table_[i] = static_cast<float>(std::sin(angle));
+			fine_cos_table_[i] = static_cast<float>(std::cos(angle));
+		}
+	}
+
+
+	template<TrigMode Mode>
+	SinCos evaluate(const uint16_t heading) const
+	{
+		if constexpr (Mode == TrigMode::table256)
+		{
+			const int index = heading >> table_shift;
+			return { sin_table_[index], cos_table_[index] };
+		}
+		else if constexpr (Mode == TrigMode::interpolated_table)
+		{
+			const int index = heading >> fine_table_shift;
+			const float fraction = static_cast<float>(heading & ((1 << fine_table_shift) - 1)) * fine_fraction_scale;
+			return {
+				fine_sin_table_[index] + (fine_sin_table_[index + 1] - fine_sin_table_[index]) * fraction,
+				fine_cos_table_[index] + (fine_cos_table_[index + 1] - fine_cos_table_[index]) * fraction };
+		}
+		else
+		{
+			return polynomial_sin_cos(heading);
+		}
+	}
+
+	template<TrigMode Mode>
+	FixedSinCos evaluate_fixed(const uint16_t heading) const
+	{
+		if constexpr (Mode == TrigMode::table256)
+		{
+			const int index = heading >> table_shift;
+			return { fixed_sin_table_[index], fixed_cos_table_[index] };
+		}
+		else
+		{
+			const SinCos sin_cos = evaluate<Mode>(heading);
+			return { static_cast<int16_t>(std::lrint(sin_cos.sin * fixed_trig_scale)), static_cast<int16_t>(std::lrint(sin_cos.cos * fixed_trig_scale)) };
+		}
+	}
+
+
+	// the move pass over a run of particles
+	template<TrigMode Mode>
+	void advance(float* positions_x, float* positions_y, const uint16_t* headings, const uint32_t count, const float step) const
+	{
+		if constexpr (Mode == TrigMode::polynomial)
+		{
+			advance_polynomial_(positions_x, positions_y, headings, count, step);
+		}
+		else
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const SinCos direction = evaluate<Mode>(headings[i]);
+				positions_x[i] += step * direction.cos;
+				positions_y[i] += step * direction.sin;
+			}
+		}
+	}
+
+
+private:
+	alignas(32) float sin_table_[table_size];
+	alignas(32) float cos_table_[table_size];
+	alignas(32) int16_t fixed_sin_table_[table_size];
+	alignas(32) int16_t fixed_cos_table_[table_size];
+
+	alignas(32) float fine_sin_table_[fine_table_size + 1];
+	alignas(32) float fine_cos_table_[fine_table_size + 1];
+
+	advance_fn advance_polynomial_ = &advance_polynomial_scalar;
+};
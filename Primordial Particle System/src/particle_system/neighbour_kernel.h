@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/*
+	Neighbour Kernel
+- counts the neighbours inside the visual radius of a particle, and how many of them are on its right hemisphere
+- the neighbour positions are gathered into flat arrays beforehand, so the loop is branch-free and data-parallel
+- an AVX2 version processes 8 neighbours per iteration, the scalar version is used when AVX2 is not available
+- every kernel is specialised on whether distances have to be wrapped on the x / y axis. the spatial grid gathers its
+  neighbours through a halo and uses the unwrapped kernel, the wrapping ones serve the neighbour lists and the border of a
+  fused step
+- the fixed-point kernels take 16-bit coordinates which wrap around together with the world, so differences need no border
+  handling. they test 16 neighbours per iteration, squared distances and the side test are exact in 32-bit integers
+*/
+
+
+// MSVC allows intrinsics in any function, GCC and Clang need the instruction set enabled per function
+#if defined(__GNUC__) || defined(__clang__)
+#define PPS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PPS_TARGET_AVX2
+#endif
+
+
+struct NeighbourCounts
+{
+	int total = 0;
+	int on_right = 0;
+};
+
+// constants shared by every call, filled in once by the particle population
+struct NeighbourKernelParams
+{
+	float radius_sq = 0.f;
+	float world_width = 0.f;
+	float world_height = 0.f;
+	float inv_width = 0.f;
+	float inv_height = 0.f;
+};
+
+using neighbour_kernel_fn = NeighbourCounts(*)(
+	const float* n_positions_x, const float* n_positions_y, int neighbours_size,
+	float x, float y, float sin_angle, float cos_angle, const NeighbourKernelParams& params);
+
+// differences of fixed-point coordinates are taken modulo 2^16. the sin and cos of the heading are passed in Q14,
+// and the neighbour arrays must have fixed_kernel_padding readable elements past the end
+using fixed_kernel_fn = NeighbourCounts(*)(
+	const int16_t* n_positions_x, const int16_t* n_positions_y, int neighbours_size,
+	int16_t x, int16_t y, int16_t sin_angle, int16_t cos_angle, int32_t radius_sq);
+
+inline constexpr float fixed_trig_scale = 16384.f;
+inline constexpr size_t fixed_kernel_padding = 16;
+
+
+// a faster implementation of the round function
+inline float fast_round(float x)
+{
+	return x >= 0.0f ? floorf(x + 0.5f) : ceilf(x - 0.5f);
+}
+
+
+template<bool AtBorderX, bool AtBorderY>
+NeighbourCounts count_neighbours_scalar(
+	const float* n_positions_x, const float* n_positions_y, const int neighbours_size,
+	const float x, const float y, const float sin_angle, const float cos_angle, const NeighbourKernelParams& params)
+{
+	NeighbourCounts counts;
+
+	for (int i{ 0 }; i < neighbours_size; ++i)
+	{
+		float direction_x = n_positions_x[i] - x;
+		float direction_y = n_positions_y[i] - y;
+
+		if constexpr (AtBorderX)
+		{
+			direction_x -= params.world_width * fast_round(direction_x * params.inv_width);
+		}
+
+		if constexpr (AtBorderY)
+		{
+			direction_y -= params.world_height * fast_round(direction_y * params.inv_height);
+		}
+
+		const float dist_sq = direction_x * direction_x + direction_y * direction_y;
+
+		if (dist_sq > 0 && dist_sq < params.radius_sq)
+		{
+			counts.on_right += (direction_x * sin_angle - direction_y * cos_angle) < 0;
+			++counts.total;
+		}
+	}
+
+	return counts;
+}
+
+
+template<bool AtBorderX, bool AtBorderY>
+PPS_TARGET_AVX2 NeighbourCounts count_neighbours_avx2(
+	const float* n_positions_x, const float* n_positions_y, const int neighbours_size,
+	const float x, const float y, const float sin_angle, const float cos_angle, const NeighbourKernelParams& params)
+{
+	const __m256 pos_x = _mm256_set1_ps(x);
+	const __m256 pos_y = _mm256_set1_ps(y);
+	const __m256 sin_a = _mm256_set1_ps(sin_angle);
+	const __m256 cos_a = _mm256_set1_ps(cos_angle);
+	const __m256 radius_sq = _mm256_set1_ps(params.radius_sq);
+	const __m256 width = _mm256_set1_ps(params.world_width);
+	const __m256 height = _mm256_set1_ps(params.world_height);
+	const __m256 inv_width = _mm256_set1_ps(params.inv_width);
+	const __m256 inv_height = _mm256_set1_ps(params.inv_height);
+	const __m256 zero = _mm256_setzero_ps();
+
+	int total = 0;
+	int on_right = 0;
+
+	// 8 neighbours at a time, the masks are turned into bits and counted
+	int i = 0;
+	for (; i + 8 <= neighbours_size; i += 8)
+	{
+		__m256 direction_x = _mm256_sub_ps(_mm256_loadu_ps(n_positions_x + i), pos_x);
+		__m256 direction_y = _mm256_sub_ps(_mm256_loadu_ps(n_positions_y + i), pos_y);
+
+		if constexpr (AtBorderX)
+		{
+			const __m256 wraps = _mm256_round_ps(_mm256_mul_ps(direction_x, inv_width), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			direction_x = _mm256_sub_ps(direction_x, _mm256_mul_ps(width, wraps));
+		}
+
+		if constexpr (AtBorderY)
+		{
+			const __m256 wraps = _mm256_round_ps(_mm256_mul_ps(direction_y, inv_height), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			direction_y = _mm256_sub_ps(direction_y, _mm256_mul_ps(height, wraps));
+		}
+
+		const __m256 dist_sq = _mm256_add_ps(_mm256_mul_ps(direction_x, direction_x), _mm256_mul_ps(direction_y, direction_y));
+		const __m256 in_range = _mm256_and_ps(_mm256_cmp_ps(dist_sq, zero, _CMP_GT_OQ), _mm256_cmp_ps(dist_sq, radius_sq, _CMP_LT_OQ));
+
+		const __m256 side = _mm256_sub_ps(_mm256_mul_ps(direction_x, sin_a), _mm256_mul_ps(direction_y, cos_a));
+		const __m256 is_right = _mm256_and_ps(in_range, _mm256_cmp_ps(side, zero, _CMP_LT_OQ));
+
+		total += std::popcount(static_cast<uint32_t>(_mm256_movemask_ps(in_range)));
+		on_right += std::popcount(static_cast<uint32_t>(_mm256_movemask_ps(is_right)));
+	}
+
+	// the remaining neighbours which do not fill a whole register
+	const NeighbourCounts tail = count_neighbours_scalar<AtBorderX, AtBorderY>(n_positions_x + i, n_positions_y + i, neighbours_size - i,
+		x, y, sin_angle, cos_angle, params);
+
+	return { total + tail.total, on_right + tail.on_right };
+}
+
+
+inline NeighbourCounts count_neighbours_fixed_scalar(
+	const int16_t* n_positions_x, const int16_t* n_positions_y, const int neighbours_size,
+	const int16_t x, const int16_t y, const int16_t sin_angle, const int16_t cos_angle, const int32_t radius_sq)
+{
+	NeighbourCounts counts;
+
+	for (int i{ 0 }; i < neighbours_size; ++i)
+	{
+		const int32_t direction_x = static_cast<int16_t>(n_positions_x[i] - x);
+		const int32_t direction_y = static_cast<int16_t>(n_positions_y[i] - y);
+		const int64_t dist_sq = static_cast<int64_t>(direction_x) * direction_x + static_cast<int64_t>(direction_y) * direction_y;
+
+		if (dist_sq > 0 && dist_sq < radius_sq)
+		{
+			counts.on_right += (direction_x * sin_angle - direction_y * cos_angle) < 0;
+			++counts.total;
+		}
+	}
+
+	return counts;
+}
+
+
+// 8 interleaved (x, y) differences: madd squares and sums each pair into 32 bits. lanes outside `valid` are ignored
+PPS_TARGET_AVX2 inline void count_fixed_pairs(const __m256i pairs, const __m256i valid, const __m256i radius, const __m256i side_weights,
+	int& total, int& on_right)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i dist_sq = _mm256_madd_epi16(pairs, pairs);
+	const __m256i in_range = _mm256_and_si256(valid, _mm256_and_si256(_mm256_cmpgt_epi32(dist_sq, zero), _mm256_cmpgt_epi32(radius, dist_sq)));
+	const __m256i is_right = _mm256_and_si256(in_range, _mm256_cmpgt_epi32(zero, _mm256_madd_epi16(pairs, side_weights)));
+
+	total += std::popcount(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(in_range))));
+	on_right += std::popcount(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(is_right))));
+}
+
+
+PPS_TARGET_AVX2 inline NeighbourCounts count_neighbours_fixed_avx2(
+	const int16_t* n_positions_x, const int16_t* n_positions_y, const int neighbours_size,
+	const int16_t x, const int16_t y, const int16_t sin_angle, const int16_t cos_angle, const int32_t radius_sq)
+{
+	const __m256i pos_x = _mm256_set1_epi16(x);
+	const __m256i pos_y = _mm256_set1_epi16(y);
+	const __m256i radius = _mm256_set1_epi32(radius_sq);
+
+	// (x, y) pairs multiplied by (sin, -cos) and summed give the side of the heading in one instruction
+	const __m256i side_weights = _mm256_set1_epi32(static_cast<int32_t>(static_cast<uint16_t>(sin_angle)
+		| static_cast<uint32_t>(static_cast<uint16_t>(-cos_angle)) << 16));
+
+	int total = 0;
+	int on_right = 0;
+
+	// 16 neighbours at a time, the differences are interleaved into (x, y) pairs. the last partial register is masked
+	// instead of finishing in scalar code, which is why the buffers have to be padded
+	const __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	for (int i = 0; i < neighbours_size; i += 16)
+	{
+		const __m256i direction_x = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(n_positions_x + i)), pos_x);
+		const __m256i direction_y = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(n_positions_y + i)), pos_y);
+		const __m256i valid = _mm256_cmpgt_epi16(_mm256_set1_epi16(static_cast<int16_t>(std::min(neighbours_size - i, 16))), lanes);
+
+		count_fixed_pairs(_mm256_unpacklo_epi16(direction_x, direction_y), _mm256_unpacklo_epi16(valid, valid), radius, side_weights, total, on_right);
+		count_fixed_pairs(_mm256_unpackhi_epi16(direction_x, direction_y), _mm256_unpackhi_epi16(valid, valid), radius, side_weights, total, on_right);
+	}
+
+	return { total, on_right };
+}
+
+
+inline bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	// the OS must also save the ymm registers on context switches
+	__cpuid(info, 1);
+	const bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+
+	__cpuidex(info, 7, 0);
+	return os_saves_ymm && (info[1] & (1 << 5));
+#elif defined(__GNUC__) || defined(__clang__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+
+// one kernel per border combination, indexed by [at_border_x][at_border_y]
+struct NeighbourKernels
+{
+	neighbour_kernel_fn kernels[2][2] = {};
+	fixed_kernel_fn fixed = nullptr;
+
+	template<bool AtBorderX, bool AtBorderY>
+	neighbour_kernel_fn get() const
+	{
+		return kernels[AtBorderX][AtBorderY];
+	}
+};
+
+
+// picks the fastest kernels the cpu can run, called once when the particle population is created
+inline NeighbourKernels select_neighbour_kernels(const char*& kernel_name)
+{
+	if (cpu_supports_avx2())
+	{
+		kernel_name = "avx2";
+		return { { { &count_neighbours_avx2<false, false>, &count_neighbours_avx2<false, true> },
+		           { &count_neighbours_avx2<true, false>, &count_neighbours_avx2<true, true> } }, &count_neighbours_fixed_avx2 };
+	}
+
+	kernel_name = "scalar";
+	return { { { &count_neighbours_scalar<false, false>, &count_neighbours_scalar<false, true> },
+	           { &count_neighbours_scalar<true, false>, &count_neighbours_scalar<true, true> } }, &count_neighbours_fixed_scalar };
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "../utils/spatial_grid.h"
+#include "../utils/thread_pool.h"
+
+/*
+	NeighbourLists
+- verlet lists: every particle keeps the indices of all particles within visual_radius + skin of it
+- a particle moves at most `gamma` per step, so two particles close in by at most 2 * gamma per step. the lists stay
+  complete until the largest displacement since the build reaches half the skin, and are only rebuilt then
+- no neighbour is ever missed between rebuilds, unlike rebuilding the grid every N steps
+- built from the spatial grid with a stencil wide enough to cover the list radius, stored in compressed-sparse-row form
+- positions are not wrapped between builds, distances across the world edge are wrapped by the neighbour kernel
+*/
+
+
+class NeighbourLists
+{
+public:
+	// the neighbours of particle i are indices[list_start[i] .. list_start[i] + list_size[i])
+	std::vector<obj_idx> indices{};
+	std::vector<uint32_t> list_start{};
+	std::vector<uint32_t> list_size{};
+
+	// bit 0 / bit 1 are set when the list of a particle may wrap on the x / y axis
+	std::vector<uint8_t> border_flags{};
+
+	// the longest list, used to size the neighbour buffers
+	uint32_t max_list_size = 0;
+
+	// how many times the lists have been rebuilt, for reporting
+	uint64_t build_count = 0;
+
+
+	bool built() const
+	{
+		return build_count > 0;
+	}
+
+	// called once per step after the particles moved
+	void step()
+	{
+		++steps_since_build_;
+	}
+
+
+	// collecting everybody within `cutoff` of each particle. the grid must have just been built from the same wrapped positions
+	void build(const SpatialGrid& grid, const float* positions_x, const float* positions_y, const size_t particle_count,
+		const float cutoff, const float world_width, const float world_height, tp::ThreadPool& thread_pool)
+	{
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const uint32_t total_cells = static_cast<uint32_t>(grid.total_cells);
+		const uint32_t cells_per_thread = total_cells / thread_count;
+		const int cells_x = static_cast<int>(grid.cells_x);
+		const int cells_y = static_cast<int>(grid.cells_y);
+
+		// the stencil must reach the cutoff, but never further than the whole grid. on an even number of cells a stencil
+		// reaching half the grid wraps onto the same column or row from both sides, the last one is then skipped
+		const int reach_x = std::min(static_cast<int>(std::ceil(cutoff / grid.m_cellSize.x)), cells_x / 2);
+		const int reach_y = std::min(static_cast<int>(std::ceil(cutoff / grid.m_cellSize.y)), cells_y / 2);
+		const int last_x = 2 * reach_x + 1 > cells_x ? reach_x - 1 : reach_x;
+		const int last_y = 2 * reach_y + 1 > cells_y ? reach_y - 1 : reach_y;
+
+		// a stencil covering the whole axis holds cells which are closer across the world edge from every cell, not just the border ones
+		const bool whole_x = 2 * reach_x + 1 >= cells_x;
+		const bool whole_y = 2 * reach_y + 1 >= cells_y;
+		const float cutoff_sq = cutoff * cutoff;
+
+		list_start.resize(particle_count);
+		list_size.resize(particle_count);
+		border_flags.resize(particle_count);
+		thread_lists_.resize(thread_count);
+		thread_candidates_.resize(thread_count);
+		thread_totals_.resize(thread_count);
+		thread_max_sizes_.resize(thread_count);
+
+		// every thread fills private lists for the particles of its cells. list_start is relative to the thread's list for now
+		thread_pool.parallel([=, this, &grid](const uint32_t t) {
+			std::vector<obj_idx>& lists = thread_lists_[t];
+			Candidates& candidates = thread_candidates_[t];
+			lists.clear();
+			uint32_t max_size = 0;
+
+			const uint32_t start = t * cells_per_thread;
+			const uint32_t end = (t == thread_count - 1) ? total_cells : start + cells_per_thread;
+
+			for (uint32_t cell_index = start; cell_index < end; ++cell_index)
+			{
+				const uint32_t cell_size = grid.objects_count[cell_index];
+				if (cell_size == 0)
+				{
+					continue;
+				}
+
+				const int cell_x = static_cast<int>(cell_index) % cells_x;
+				const int cell_y = static_cast<int>(cell_index) / cells_x;
+				const uint8_t flags = static_cast<uint8_t>((whole_x || cell_x < reach_x || cell_x >= cells_x - reach_x)
+					| (whole_y || cell_y < reach_y || cell_y >= cells_y - reach_y) << 1);
+
+				// the candidates are gathered once per cell and shared by all of its particles
+				candidates.clear();
+				for (int offset_y = -reach_y; offset_y <= last_y; ++offset_y)
+				{
+					const int neighbour_y = wrap(cell_y + offset_y, cells_y);
+					for (int offset_x = -reach_x; offset_x <= last_x; ++offset_x)
+					{
+						const cell_idx neighbour = neighbour_y * cells_x + wrap(cell_x + offset_x, cells_x);
+						const obj_idx* contents = grid.cell_contents(neighbour);
+						for (uint32_t slot = 0; slot < grid.objects_count[neighbour]; ++slot)
+						{
+							candidates.x.push_back(positions_x[contents[slot]]);
+							candidates.y.push_back(positions_y[contents[slot]]);
+							candidates.index.push_back(contents[slot]);
+						}
+					}
+				}
+
+				const obj_idx* contents = grid.cell_contents(cell_index);
+				for (uint32_t slot = 0; slot < cell_size; ++slot)
+				{
+					const obj_idx particle = contents[slot];
+					const float x = positions_x[particle];
+					const float y = positions_y[particle];
+					const auto first = static_cast<uint32_t>(lists.size());
+
+					// every candidate is written and the end only advances past the ones in range, so the loop has no branches
+					lists.resize(first + candidates.index.size());
+					uint32_t end_of_list = first;
+					if (flags)
+					{
+						end_of_list = collect<true>(candidates, x, y, particle, cutoff_sq, world_width, world_height, lists.data(), end_of_list);
+					}
+					else
+					{
+						end_of_list = collect<false>(candidates, x, y, particle, cutoff_sq, world_width, world_height, lists.data(), end_of_list);
+					}
+					lists.resize(end_of_list);
+
+					list_start[particle] = first;
+					list_size[particle] = end_of_list - first;
+					border_flags[particle] = flags;
+					max_size = std::max(max_size, list_size[particle]);
+				}
+			}
+
+			thread_totals_[t] = static_cast<uint32_t>(lists.size());
+			thread_max_sizes_[t] = max_size;
+			});
+
+		// exclusive prefix sum over the threads, then every thread copies its lists into place and offsets its starts
+		uint32_t running_total = 0;
+		for (uint32_t t = 0; t < thread_count; ++t)
+		{
+			const uint32_t total = thread_totals_[t];
+			thread_totals_[t] = running_total;
+			running_total += total;
+		}
+		indices.resize(running_total);
+		max_list_size = *std::max_element(thread_max_sizes_.begin(), thread_max_sizes_.end());
+
+		thread_pool.parallel([=, this, &grid](const uint32_t t) {
+			const uint32_t base = thread_totals_[t];
+			std::copy(thread_lists_[t].begin(), thread_lists_[t].end(), indices.begin() + base);
+
+			const uint32_t start = t * cells_per_thread;
+			const uint32_t end = (t == thread_count - 1) ? total_cells : start + cells_per_thread;
+			for (uint32_t cell_index = start; cell_index < end; ++cell_index)
+			{
+				const obj_idx* contents = grid.cell_contents(cell_index);
+				for (uint32_t slot = 0; slot < grid.objects_count[cell_index]; ++slot)
+				{
+					list_start[contents[slot]] += base;
+				}
+			}
+			});
+
+		// the displacements are measured from here
+		build_positions_x_.assign(positions_x, positions_x + particle_count);
+		build_positions_y_.assign(positions_y, positions_y + particle_count);
+		list_radius_ = cutoff;
+		steps_since_build_ = 0;
+		++build_count;
+	}
+
+	// true once two particles could have closed in by more than the skin since the last build
+	bool expired(const float* positions_x, const float* positions_y, const size_t particle_count,
+		const float interaction_radius, const float step_length, tp::ThreadPool& thread_pool)
+	{
+		// the lists index the particles, they are stale once particles were added or removed
+		if (!built() || list_start.size() != particle_count)
+		{
+			return true;
+		}
+
+		const float skin = list_radius_ - interaction_radius;
+
+		// nobody can have moved further than one step length per step, which usually settles it without looking at the particles
+		if (2.f * step_length * static_cast<float>(steps_since_build_) < skin)
+		{
+			return false;
+		}
+
+		// otherwise the actual displacements are measured. particles turning on the spot barely move away from where they were
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const size_t particles_per_thread = particle_count / thread_count;
+		thread_max_displacements_.resize(thread_count);
+
+		thread_pool.parallel([=, this](const uint32_t t) {
+			const size_t start = t * particles_per_thread;
+			const size_t end = (t == thread_count - 1) ? particle_count : start + particles_per_thread;
+
+			float max_displacement_sq = 0.f;
+			for (size_t i = start; i < end; ++i)
+			{
+				const float dx = positions_x[i] - build_positions_x_[i];
+				const float dy = positions_y[i] - build_positions_y_[i];
+				max_displacement_sq = std::max(max_displacement_sq, dx * dx + dy * dy);
+			}
+			thread_max_displacements_[t] = max_displacement_sq;
+			});
+
+		const float max_displacement = std::sqrt(*std::max_element(thread_max_displacements_.begin(), thread_max_displacements_.end()));
+		return 2.f * max_displacement >= skin;
+	}
+
+
+private:
+	struct Candidates
+	{
+		std::vector<float> x, y;
+		std::vector<obj_idx> index;
+
+		void clear()
+		{
+			x.clear();
+			y.clear();
+			index.clear();
+		}
+	};
+
+	// appending the candidates within the cutoff to `list`, distances are only wrapped for cells near the border
+	template<bool Wrap>
+	static uint32_t collect(const Candidates& candidates, const float x, const float y, const obj_idx particle, const float cutoff_sq,
+		const float world_width, const float world_height, obj_idx* list, uint32_t end_of_list)
+	{
+		const float inv_width = 1.f / world_width;
+		const float inv_height = 1.f / world_height;
+		const size_t count = candidates.index.size();
+
+		for (size_t c = 0; c < count; ++c)
+		{
+			float direction_x = candidates.x[c] - x;
+			float direction_y = candidates.y[c] - y;
+			if constexpr (Wrap)
+			{
+				direction_x -= world_width * std::nearbyint(direction_x * inv_width);
+				direction_y -= world_height * std::nearbyint(direction_y * inv_height);
+			}
+
+			list[end_of_list] = candidates.index[c];
+			end_of_list += (direction_x * direction_x + direction_y * direction_y < cutoff_sq) & (candidates.index[c] != particle);
+		}
+
+		return end_of_list;
+	}
+
+	static int wrap(const int index, const int cells)
+	{
+		return index >= 0 ? (index < cells ? index : index - cells) : (index + cells);
+	}
+
+	// per-thread lists and candidates while building
+	std::vector<std::vector<obj_idx>> thread_lists_{};
+	std::vector<Candidates> thread_candidates_{};
+	std::vector<uint32_t> thread_totals_{};
+	std::vector<uint32_t> thread_max_sizes_{};
+	std::vector<float> thread_max_displacements_{};
+
+	// where the particles were when the lists were built
+	std::vector<float> build_positions_x_{};
+	std::vector<float> build_positions_y_{};
+	float list_radius_ = 0.f; // visual radius + skin
+	uint32_t steps_since_build_ = 0;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../utils/huge_pages.h"
+#include "../utils/spatial_grid.h"
+#include "../utils/thread_pool.h"
+
+/*
+	ParticleStore
+- the state of every particle, one column per quantity (SoA), shared by the population, the beacons and the renderer
+- a particle is its index, the same in every column
+- every column starts on a 64-byte boundary and is padded with zeros to whole cache lines, so simd loops can load the last
+  particles at full width without reading past the allocation, and two columns never share a line
+- columns of 2 MB or more are backed by huge pages where the system allows it, see utils/huge_pages.h
+- permute() moves every particle to a new index at once, and drops the particles left out. it gathers into spare columns
+  and swaps them in, so references to the store stay valid
+*/
+
+
+class ParticleStore
+{
+public:
+	template<typename T>
+	using Column = AlignedVector<T>;
+
+	// the new index of a particle permute() dropped
+	inline static constexpr obj_idx no_particle = ~obj_idx{ 0 };
+
+	// the columns hold a multiple of this many particles, a whole number of cache lines for the narrowest column
+	inline static constexpr size_t padding = AlignedAllocator<uint16_t>::alignment / sizeof(uint16_t);
+
+	Column<float> positions_x;
+	Column<float> positions_y;
+	Column<uint16_t> headings;         // binary angles, 65536 to a full turn
+	Column<uint16_t> neighbour_counts; // how many particles were within the visual radius at the last step
+	Column<float> angles;              // the headings in radians, only refreshed for the renderer
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	static constexpr size_t padded_size(const size_t count)
+	{
+		return (count + padding - 1) / padding * padding;
+	}
+
+	size_t padded_size() const
+	{
+		return padded_size(size_);
+	}
+
+
+	// new particles start out all zero. the padding behind the last particle is zeroed again when shrinking
+	void resize(const size_t count)
+	{
+		size_ = count;
+		for_each_column([count](auto& column)
+		{
+			column.resize(padded_size(count));
+			std::fill(column.begin() + count, column.end(), 0);
+		});
+	}
+
+
+	// moving the particle at order[k] to index k, for every k. a shorter order keeps only the particles it lists, the rest are
+	// removed. new_index_of receives the inverse, no_particle for the removed ones, to update indices held elsewhere.
+	// the angles are derived from the headings and left behind
+	void permute(const std::vector<obj_idx>& order, std::vector<obj_idx>& new_index_of, tp::ThreadPool& thread_pool)
+	{
+		const size_t kept = order.size();
+		new_index_of.resize(size_);
+		if (kept < size_)
+		{
+			std::fill(new_index_of.begin(), new_index_of.end(), no_particle);
+		}
+
+		thread_pool.dispatch(static_cast<uint32_t>(kept), [this, &order, &new_index_of](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t k = start; k < end; ++k)
+			{
+				const obj_idx old_index = order[k];
+				spare_positions_x_[k] = positions_x[old_index];
+				spare_positions_y_[k] = positions_y[old_index];
+				spare_headings_[k] = headings[old_index];
+				spare_neighbour_counts_[k] = neighbour_counts[old_index];
+				new_index_of[old_index] = k;
+			}
+		});
+
+		positions_x.swap(spare_positions_x_);
+		positions_y.swap(spare_positions_y_);
+		headings.swap(spare_headings_);
+		neighbour_counts.swap(spare_neighbour_counts_);
+
+		if (kept < size_)
+		{
+			resize(kept);
+		}
+	}
+
+
+	// placing every column on the numa nodes of the threads that work on it, see tp::firstTouch(). false if any could not be
+	bool first_touch(tp::ThreadPool& thread_pool)
+	{
+		bool placed = true;
+		for_each_column([&placed, &thread_pool](auto& column)
+		{
+			placed &= tp::firstTouch(column, thread_pool);
+		});
+		return placed;
+	}
+
+
+	void page_backing(PageBacking& backing)
+	{
+		for_each_column([&backing](const auto& column)
+		{
+			backing.add(column);
+		});
+	}
+
+
+private:
+	// the columns and the spares permute() gathers into, which are swapped with them and so placed along with them
+	template<typename Function>
+	void for_each_column(Function&& function)
+	{
+		function(positions_x);
+		function(positions_y);
+		function(headings);
+		function(neighbour_counts);
+		function(angles);
+		function(spare_positions_x_);
+		function(spare_positions_y_);
+		function(spare_headings_);
+		function(spare_neighbour_counts_);
+	}
+
+	size_t size_ = 0;
+
+	Column<float> spare_positions_x_;
+	Column<float> spare_positions_y_;
+	Column<uint16_t> spare_headings_;
+	Column<uint16_t> spare_neighbour_counts_;
+};
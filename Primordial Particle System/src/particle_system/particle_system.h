@@ -1,19 +1,27 @@
 ﻿#pragma once
 
-#include <SFML/Graphics.hpp>
 #include <cmath>
 #include <array>
-#include <xmmintrin.h>
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
 #include <vector>
 #include <omp.h> // For OpenMP parallelization
 
-#include "PPS_renderer.h"
 #include "beacons.h"
+#include "cell_storage.h"
+#include "heading_trig.h"
+#include "neighbour_kernel.h"
+#include "neighbour_lists.h"
+#include "particle_store.h"
 
 #include "../settings.h"
 
 #include "../utils/spatial_grid.h"
 #include "../utils/random.h"
+#include "../utils/scratch_arena.h"
 #include "../utils/thread_pool.h"
 
 
@@ -43,412 +51,1893 @@ inline static constexpr float pi = 3.141592653589793238462643383279502884197f;
 inline static constexpr float two_pi = 2.f * pi;
 inline static constexpr float pi_div_180 = pi / 180.f;
 
+// headings are 16-bit binary angles: a full turn is 65536, so wrapping around is free and a shift turns them into a table index
+inline static constexpr float binary_angles_per_degree = 65536.f / 360.f;
+inline static constexpr float binary_angles_per_radian = 65536.f / two_pi;
 
-// a faster implementation of the round function
-inline float fast_round(float x) 
-{
-	return x >= 0.0f ? floorf(x + 0.5f) : ceilf(x - 0.5f);
-}
 
 inline static constexpr size_t max_beacon_count = 100;
 inline static constexpr float init_position_scatter = 150.f; // scattering radius of the positions
 
-template<size_t PopulationSize>
 class ParticlePopulation : PPS_Settings
 {
-	// Aligned memory allocation for better vectorization
-	alignas(32) std::vector<float> positions_x_;
-	alignas(32) std::vector<float> positions_y_;
-	alignas(32) std::vector<float> angles_;
-	alignas(32) std::vector<uint16_t> neighbourhood_count_; // used by the renderer
+	// positions, headings and neighbour counts in cache-aligned, padded columns, shared with the beacons and the renderer.
+	// the number of particles is chosen at runtime and can change mid-run, see set_particle_count()
+	ParticleStore particles_;
+
+	// the size of the world, from the PopulationConfig
+	float world_width_ = 0.f;
+	float world_height_ = 0.f;
+
+	// how many steps have been taken, step() keys the grid maintenance off it
+	size_t iterations_ = 0;
+
+	// sin and cos of the headings, evaluated as chosen by trig_mode
+	HeadingTrig trig_{};
+
+	// the scale from world units to fixed-point units, for PositionFormat::fixed16
+	float fixed_scale_ = 0.f;
+	int32_t fixed_radius_sq_ = 0;
+
+	// alpha and beta of the update rules in binary angles, and the values they were converted from
+	int32_t turn_alpha_ = 0;
+	int32_t turn_beta_ = 0;
+	float turn_rules_alpha_ = 0.f;
+	float turn_rules_beta_ = 0.f;
+
+	// 16-bit coordinates wrap every 65536 units. the scale is chosen so the world is a whole number of wraps on both axes,
+	// then differences across the world edge come out right by themselves. world_width / world_height is the screen's ratio
+	inline static constexpr unsigned fixed_wraps_x = SimulationSettings::screen_width / std::gcd(SimulationSettings::screen_width, SimulationSettings::screen_height);
 
-	// Pre-computed constants for fast lookup
-	static constexpr int ANGLE_TABLE_SIZE = 256;
-	alignas(32) float sin_table_[ANGLE_TABLE_SIZE];
-	alignas(32) float cos_table_[ANGLE_TABLE_SIZE];
+	// the positions in fixed point, refreshed every step
+	std::vector<int16_t> fixed_positions_x_;
+	std::vector<int16_t> fixed_positions_y_;
 
 	// The Spatial Grid Optimizes finding who is nearby
-	SpatialGrid<grid_cells_x, grid_cells_y> spatial_grid;
+	SpatialGrid spatial_grid;
+
+	// how many cells the neighbourhood reaches out on each side, a (2 * reach + 1)^2 stencil. worked out from the cell size
+	// whenever the grid is resized, see stencil_reach_for()
+	int stencil_reach_ = 1;
+
+	// the grid is seen through a halo of stencil_reach_ cells on every side. a halo column or row stands for the one on the far
+	// side of the world, and its particles are gathered shifted by a whole world size onto this side. every neighbour cell is
+	// looked up here, so the gathers never wrap indices and the interior kernel gives the wrapped distances everywhere
+	struct HaloLine
+	{
+		uint32_t index; // the column or row the halo line copies
+		float shift;    // added to the coordinates of its particles
+	};
+	std::vector<HaloLine> halo_columns_; // indexed by column + stencil_reach_
+	std::vector<HaloLine> halo_rows_;    // indexed by row + stencil_reach_
+
+	// how many cells a particle can drift across the world edge from the cell it is stored in, see border_width()
+	uint32_t drift_border_ = 0;
+
+	// with the cell-resident engine the particles live inside the grid cells, and the flat arrays are only refreshed for rendering
+	CellResidentStorage<cell_block_width> resident_particles_;
+
+	// verlet lists, rebuilt from the grid only when a neighbour could otherwise be missed
+	NeighbourLists neighbour_lists_;
+	static_assert(!neighbour_lists || storage_engine == StorageEngine::index_grid, "neighbour lists index the flat particle arrays");
+	static_assert(position_format == PositionFormat::float32 || (storage_engine == StorageEngine::index_grid && !neighbour_lists),
+		"fixed-point positions are gathered through the spatial grid");
+
+	// the order the particles were permuted into by the last reorder: slot k holds the particle previously at particle_order_[k].
+	// new_index_of_ is the inverse, used to keep indices held elsewhere (e.g. beacons) pointing at the same particles
+	std::vector<obj_idx> particle_order_;
+	std::vector<obj_idx> new_index_of_;
+	bool particles_sorted_ = false;
+
+	// with fused_step the collision pass writes the moved positions here, so the neighbours still read where everybody was.
+	// swapped with the positions at the end of the step
+	ParticleStore::Column<float> next_positions_x_;
+	ParticleStore::Column<float> next_positions_y_;
+	static_assert(!fused_step || storage_engine == StorageEngine::index_grid, "the fused step double buffers the flat position arrays");
+
+	// set while the collision pass also moves the particles
+	bool fusing_step_ = false;
+
+	// the positions are only wrapped back into the world when the grid is rebuilt, unless the fused step wraps them as it moves them.
+	// neighbour lists compare positions against where they were at the last build, so they keep them unwrapped
+	inline static constexpr bool wrapped_every_step = fused_step && !neighbour_lists;
+
+	// how many particles a thread claims at a time when walking the neighbour lists
+	inline static constexpr uint32_t list_chunk_size = 512;
+
+	// with LoadBalancing::cost_weighted: how many particles are in the column of 2 * reach + 1 cells around every cell, the estimated
+	// cost of every cell and every row, and the cell each thread's slice starts at
+	std::vector<uint32_t> column_populations_;
+	std::vector<uint32_t> cell_costs_;
+	std::vector<uint64_t> row_costs_;
+	std::vector<uint32_t> collision_splits_;
+	uint32_t steps_since_weighing_ = 0;
+
+	// what every thread did in the collision passes since the last load balance report
+	std::vector<uint64_t> collision_busy_ns_;
+	std::vector<uint64_t> collision_chunks_;
+	uint64_t collision_steals_ = 0;
+	uint64_t collision_passes_ = 0;
 
 	// pre-computed
 	float inv_width_ = 0.f;
 	float inv_height_ = 0.f;
 
-	// temporary arrays for calculating particle interactions. One array needed for each thread to avoid issues with data writing.
-	std::array<std::array<float, cell_capacity * 9>, threads> neighbour_positions_x;
-	std::array<std::array<float, cell_capacity * 9>, threads> neighbour_positions_y;
+	// temporary arrays for calculating particle interactions. One buffer needed for each thread to avoid issues with data writing.
+	// they are carved out of the thread's scratch arena and grow with the densest cell, so no neighbours are ever dropped.
+	// each buffer fills whole cache lines, so two threads never write to the same line
+	struct alignas(64) NeighbourBuffer
+	{
+		float* positions_x = nullptr;
+		float* positions_y = nullptr;
+
+		// the same neighbours in 16-bit fixed point, only used with PositionFormat::fixed16
+		int16_t* fixed_x = nullptr;
+		int16_t* fixed_y = nullptr;
+		size_t capacity = 0;
+
+		// the rest of the thread's arena, for memory only needed while a row or cell is solved. rewound after use
+		ScratchArena* scratch = nullptr;
+	};
+	std::array<NeighbourBuffer, threads> neighbour_buffers_;
+	std::array<ScratchArena, threads> scratch_arenas_;
+	size_t scratch_row_capacity_ = 0; // the longest row the arenas keep room for, in cells
 
 	tp::ThreadPool thread_pool;
 
-public:
-	Beacons<max_beacon_count, grid_cells_x, grid_cells_y> beacons{ spatial_grid, 
-		positions_x_, positions_y_, spatial_grid.m_cellSize.x, world_width, world_height };
+	// whether the threads were pinned and the particle arrays first touched by them, for the placement report
+	bool threads_pinned_ = false;
+	bool memory_placed_ = false;
+
+	// the neighbour counting kernel is chosen at start-up depending on what the cpu supports
+	NeighbourKernels neighbour_kernels_{};
+	NeighbourKernelParams kernel_params_{};
 
-	PPS_Renderer pps_renderer_;
+public:
+	Beacons<max_beacon_count> beacons{ spatial_grid, particles_, world_width_, world_height_ };
 
 
 public:
-	explicit ParticlePopulation(sf::RenderWindow& window) : spatial_grid({0, 0, world_width, world_height}),
-	  pps_renderer_(window, positions_x_, positions_y_, angles_, neighbourhood_count_), thread_pool(threads) // , angles_, neighbourhood_count_
+	explicit ParticlePopulation(const PopulationConfig& config = {})
+	  : world_width_(config.world_width()), world_height_(config.world_height()),
+	  spatial_grid(config.world_width(), config.world_height(), config.cells_x(), config.cells_y()),
+	  thread_pool(threads)
 	{
-		inv_width_ = 1.f / world_width;
-		inv_height_ = 1.f / world_height;
+		inv_width_ = 1.f / world_width_;
+		inv_height_ = 1.f / world_height_;
+		spatial_grid.reserve_slack = incremental_grid;
+		spatial_grid.stable_order = deterministic;
+
+		if constexpr (deterministic)
+		{
+			Random::set_seed(seed);
+		}
 
-		init_particle_vectors();
-		init_sin_cos_tables();
+		init_grid_resolution(config);
+		init_neighbour_kernel();
+		init_halo();
+		init_thread_placement();
+		init_particle_vectors(config.particle_count);
+		first_touch_memory();
+		report_page_backing();
 		init_grid_positioning();
 		randomize_angles();
 
-		pps_renderer_.init();
-	
 		// choosing 20 random particles to put at the center
-		create_cell_at({ world_width / 2.f, world_height / 2.f }, 35);
+		create_cell_at(world_width_ / 2.f, world_height_ / 2.f, 35);
+
+		// the scatter can place particles just outside the world, the fused step expects them inside from the start
+		wrap_positions();
 	}
 
 
 	void init_grid_positioning()
 	{
 		// Calculate the number of columns and rows for a nearly square render_grid_
-		int cols = static_cast<int>(std::sqrt(PopulationSize * (world_width / world_height)));
-		int rows = PopulationSize / cols + (PopulationSize % cols > 0); // Ensure we cover all particles
+		const size_t cols = static_cast<size_t>(std::sqrt(particles_.size() * (world_width_ / world_height_)));
+		const size_t rows = particles_.size() / cols + (particles_.size() % cols > 0); // Ensure we cover all particles
 
 		// Calculate the spacing between particles
-		const float spacingX = world_width / cols;
-		const float spacingY = world_height / rows;
+		const float spacingX = world_width_ / cols;
+		const float spacingY = world_height_ / rows;
 
-		int inc = 0;
-		for (int row = 0; row < rows; ++row)
+		size_t inc = 0;
+		for (size_t row = 0; row < rows; ++row)
 		{
-			for (int col = 0; col < cols; ++col)
+			for (size_t col = 0; col < cols; ++col)
 			{
-				if (inc < PopulationSize)
+				if (inc < particles_.size())
 				{
-					positions_x_[inc] = col * spacingX + Random::rand11_float() * init_position_scatter;
-					positions_y_[inc] = row * spacingY + Random::rand11_float() * init_position_scatter;
-					angles_[inc] = Random::rand01_float() * pi;
+					particles_.positions_x[inc] = col * spacingX + Random::rand11_float() * init_position_scatter;
+					particles_.positions_y[inc] = row * spacingY + Random::rand11_float() * init_position_scatter;
+					particles_.headings[inc] = to_binary_angle(Random::rand01_float() * pi);
 					inc++;
 				}
 			}
 		}
 	}
 
-	void create_cell_at(const sf::Vector2f position, const int particle_count)
+	void create_cell_at(const float x, const float y, const int particle_count)
 	{
 		// chooses random particles in the world to concentrate at a certain position.
 		// due to the nature of the simulation, random sampling like this does not affect any of the existing cells
 		for (int _ = 0; _ < particle_count; ++_)
 		{
-			const int index = Random::rand_range(size_t(0), PopulationSize);
-			positions_x_[index] = position.x;
-			positions_y_[index] = position.y;
+			const int index = Random::rand_range(size_t(0), particles_.size() - 1);
+			particles_.positions_x[index] = x;
+			particles_.positions_y[index] = y;
 		}
 	}
 
 	
-	void add_particles_to_grid()
+	// growing or shrinking the population mid-run. new particles are scattered over the whole world with random headings
+	void set_particle_count(const size_t particle_count)
 	{
-		// At the start of every Nth iteration. all the particles need to be removed from the render_grid_ and re-added
-		spatial_grid.clear();
+		if (particle_count == 0)
+		{
+			std::cerr << "[ERROR]: the population needs at least one particle\n";
+			return;
+		}
 
-		// process is split across multiple threads
-		const uint32_t thread_count = thread_pool.m_thread_count;
-		const size_t particles_per_thread = PopulationSize / thread_count;
-		const size_t last_thread_particles = PopulationSize - (thread_count - 1) * particles_per_thread;
+		// with the cell-resident engine the current state is in the cell blocks
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			export_resident_particles();
+		}
 
-		for (uint32_t t = 0; t < thread_count; ++t)
+		const size_t previous_count = particles_.size();
+		if (particle_count < previous_count)
+		{
+			remove_random_particles(previous_count - particle_count);
+		}
+		else if (particle_count > previous_count)
 		{
-			thread_pool.addTask([this, t, particles_per_thread, last_thread_particles, thread_count] {
-				const size_t start = t * particles_per_thread;
-				const size_t end = (t == thread_count - 1) ? start + last_thread_particles : start + particles_per_thread;
+			particles_.resize(particle_count);
+			for (size_t i = previous_count; i < particle_count; ++i)
+			{
+				particles_.positions_x[i] = Random::rand01_float() * world_width_;
+				particles_.positions_y[i] = Random::rand01_float() * world_height_;
+				particles_.headings[i] = to_binary_angle(Random::rand_range(0.f, 2.f * pi));
+			}
+		}
+		resize_particle_buffers();
 
-				for (size_t i = start; i < end; ++i)
-				{
-					// positions are fetched and wrapped
-					float& x = positions_x_[i];
-					float& y = positions_y_[i];
+		// everything indexing the particles starts over from the new arrays
+		particles_sorted_ = false;
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			wrap_positions();
+			resident_particles_.load(spatial_grid, particles_.positions_x.data(), particles_.positions_y.data(), particles_.headings.data(), particles_.neighbour_counts.data(), particles_.size());
+			resize_neighbour_buffers(resident_particles_.max_cell_size());
+		}
+		else if constexpr (neighbour_lists)
+		{
+			update_neighbour_lists();
+		}
+		else
+		{
+			add_particles_to_grid();
+		}
 
-					// wrapping positions
-					if (x < 0.0f || x >= world_width)
-					{
-						x -= world_width * std::floor(x * inv_width_);
-					}
+		std::cout << "[INFO]: the population is now " << particles_.size() << " particles\n";
+	}
 
-					if (y < 0.0f || y >= world_height)
-					{
-						y -= world_height * std::floor(y * inv_height_);
-					}
+	void add_particles(const size_t count)
+	{
+		set_particle_count(particles_.size() + count);
+	}
 
-					spatial_grid.add_object(x, y, i);
-				}
-				});
-		}
+	void remove_particles(const size_t count)
+	{
+		set_particle_count(particles_.size() - std::min(count, particles_.size() - 1));
+	}
+
+	size_t particle_count() const
+	{
+		return particles_.size();
+	}
 
-		// syncing threads
-		thread_pool.waitForCompletion();
+	float world_width() const
+	{
+		return world_width_;
 	}
 
+	float world_height() const
+	{
+		return world_height_;
+	}
 
-	void update_particles(const bool paused = false)
+	size_t iterations() const
 	{
-		solveCollisions();
+		return iterations_;
+	}
 
-		if (!paused)
-		{
-			update_particle_positions();
-		}
+	// the particle state and the grid, read by the renderer. see sync_particle_store() for when the flat arrays are current
+	ParticleStore& particles()
+	{
+		return particles_;
+	}
 
+	const SpatialGrid& grid() const
+	{
+		return spatial_grid;
 	}
 
 
-	void render(sf::RenderWindow& window, const bool draw_spatial_grid = false, const sf::Vector2f pos = {0 ,0})
+	// - one time step: the grid or the neighbour lists are brought up to date as often as the settings ask, then every particle
+	//   is updated. this is the whole stepping schedule, the window and a headless run both drive the population through it
+	// - particles don't move very much and take many time steps to cross grid spaces, so updating their grid location happens
+	//   every nth step
+	void step(const bool paused = false)
 	{
-		//positions_[0] = pos;
-		if (draw_spatial_grid)
+		if constexpr (neighbour_lists)
+		{
+			update_neighbour_lists();
+		}
+		else if (!deterministic && grid_tuning_freq > 0 && iterations_ % grid_tuning_freq == 0)
+		{
+			tune_grid_resolution();
+		}
+		else if (iterations_ % add_to_grid_freq == 0)
+		{
+			add_particles_to_grid();
+		}
+		else if constexpr (incremental_grid)
 		{
-			spatial_grid.render_grid(window);
+			update_grid();
 		}
 
-		pps_renderer_.render();
+		update_particles(paused);
+		++iterations_;
 	}
 
-
-	static void render_debug(sf::RenderWindow& window, const sf::Vector2f mouse_pos, const float debug_radius)
+	
+	void add_particles_to_grid()
 	{
-		
-	}
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			migrate_resident_particles();
+			return;
+		}
+
+		if constexpr (!wrapped_every_step)
+		{
+			wrap_positions();
+		}
+
+		spatial_grid.build(particles_.positions_x.data(), particles_.positions_y.data(), particles_.size(), thread_pool);
+		resize_neighbour_buffers(spatial_grid.max_cell_size);
 
+		if constexpr (reorder_by_cell)
+		{
+			reorder_particles_by_cell();
+		}
 
+		if (spatial_grid.inserted_count != particles_.size())
+		{
+			std::cerr << "[ERROR]: spatial grid holds " << spatial_grid.inserted_count << " of " << particles_.size() << " particles\n";
+		}
+	}
 
 
-private:
-	void init_sin_cos_tables()
+	// times a few collision passes with cells of r, r / 2 and r / 3 (3x3, 5x5 and 7x7 stencils) and keeps the fastest for the
+	// current density. the grid is rebuilt for every candidate, so this replaces the rebuild of the step it is called on
+	void tune_grid_resolution()
 	{
-		// pre-computing values for the sin and cos tables
-		for (int i = 0; i < ANGLE_TABLE_SIZE; ++i)
+		if constexpr (neighbour_lists)
 		{
-			float angle = (i / static_cast<float>(ANGLE_TABLE_SIZE)) * two_pi;
-			sin_table_[i] = std::sin(angle);
-			cos_table_[i] = std::cos(angle);
+			// the neighbour lists choose their own stencil, the grid only feeds the list builds
+			update_neighbour_lists();
+		}
+		else
+		{
+			// the timed passes run on the flat arrays or reload the cell blocks from them, they start from the same state each time
+			if constexpr (storage_engine == StorageEngine::cell_resident)
+			{
+				export_resident_particles();
+			}
+
+			GridCandidate candidates[3];
+			for (int reach = 1; reach <= 3; ++reach)
+			{
+				GridCandidate& candidate = candidates[reach - 1];
+				candidate = grid_for_reach(reach);
+
+				set_grid_resolution(candidate);
+				candidate.milliseconds = time_grid_resolution();
+			}
+
+			const GridCandidate& best = *std::min_element(std::begin(candidates), std::end(candidates),
+				[](const GridCandidate& a, const GridCandidate& b) { return a.milliseconds < b.milliseconds; });
+			set_grid_resolution(best);
+
+			std::cout << "[INFO]: grid tuning,";
+			for (const GridCandidate& candidate : candidates)
+			{
+				const int width = 2 * candidate.reach + 1;
+				std::cout << " r/" << candidate.reach << ' ' << candidate.cells_x << 'x' << candidate.cells_y << " cells " << width << 'x' << width
+					<< " stencil " << candidate.milliseconds << " ms/step,";
+			}
+			std::cout << " keeping r/" << best.reach << '\n';
 		}
 	}
 
-	void init_particle_vectors()
+
+	void update_grid()
 	{
-		// resizing vectors to the population size
-		positions_x_.resize(PopulationSize);
-		positions_y_.resize(PopulationSize);
-		angles_.resize(PopulationSize);
-		neighbourhood_count_.resize(PopulationSize);
+		// keeping the grid exact between full rebuilds, only the particles whose cell changed are moved
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			migrate_resident_particles();
+			return;
+		}
+
+		if constexpr (!wrapped_every_step)
+		{
+			wrap_positions();
+		}
+
+		// the moved particles are no longer stored in cell order
+		particles_sorted_ = false;
+
+		spatial_grid.update(particles_.positions_x.data(), particles_.positions_y.data(), particles_.size(), thread_pool);
+		resize_neighbour_buffers(spatial_grid.max_cell_size);
 	}
 
-	void randomize_angles()
+
+	void update_neighbour_lists()
 	{
-		for (size_t i = 0; i < PopulationSize; ++i)
+		// the lists are rebuilt together with the grid, once the particles could have moved by half the skin
+		if (!neighbour_lists_.expired(particles_.positions_x.data(), particles_.positions_y.data(), particles_.size(), visual_radius, gamma, thread_pool))
 		{
-			angles_[i] = Random::rand_range(0.f, 2.f * pi);
+			return;
 		}
+
+		add_particles_to_grid();
+		neighbour_lists_.build(spatial_grid, particles_.positions_x.data(), particles_.positions_y.data(), particles_.size(),
+			visual_radius + verlet_skin, world_width_, world_height_, thread_pool);
+		reserve_neighbour_buffers(neighbour_lists_.max_list_size);
 	}
 
 
-	void update_particle_positions()
+	void wrap_positions()
 	{
-		// updating the positions of each particles in the direction of their angle by step size `gamma`
+		// At the start of every Nth iteration. all the particles are wrapped back into the world before the grid is rebuilt
+		// process is split across multiple threads
 		const uint32_t thread_count = thread_pool.m_thread_count;
-		const int particles_per_thread = particle_count / thread_count;
-		const int last_thread_particles = particle_count - (thread_count - 1) * particles_per_thread;
-
-		for (uint32_t t = 0; t < thread_count; ++t)
-		{
-			thread_pool.addTask([this, t, particles_per_thread, last_thread_particles, thread_count] {
-				const int start = t * particles_per_thread;
-				const int end = (t == thread_count - 1) ? start + last_thread_particles : start + particles_per_thread;
+		const size_t particles_per_thread = particles_.size() / thread_count;
+		const size_t last_thread_particles = particles_.size() - (thread_count - 1) * particles_per_thread;
 
-				for (int i = start; i < end; ++i)
-				{
-					// Update position
-					float& angle = angles_[i];
-					const int angle_index = static_cast<int>((angle / two_pi) * ANGLE_TABLE_SIZE) & (ANGLE_TABLE_SIZE - 1);
+		thread_pool.parallel([this, particles_per_thread, last_thread_particles, thread_count](const uint32_t t) {
+			const size_t start = t * particles_per_thread;
+			const size_t end = (t == thread_count - 1) ? start + last_thread_particles : start + particles_per_thread;
 
-					angle = fmod(angle, two_pi);
-					angle += two_pi * (angle < 0.0f);
+			for (size_t i = start; i < end; ++i)
+			{
+				// positions are fetched and wrapped
+				float& x = particles_.positions_x[i];
+				float& y = particles_.positions_y[i];
 
-					positions_x_[i] += gamma * cos_table_[angle_index];
-					positions_y_[i] += gamma * sin_table_[angle_index];
+				// wrapping positions
+				if (x < 0.0f || x >= world_width_)
+				{
+					x -= world_width_ * std::floor(x * inv_width_);
 				}
-				});
-		}
 
-		thread_pool.waitForCompletion();
+				if (y < 0.0f || y >= world_height_)
+				{
+					y -= world_height_ * std::floor(y * inv_height_);
+				}
+			}
+			});
 	}
 
 
-	void solveCollisionThreaded(uint32_t start, uint32_t end, int thread_idx)
+	// the permutation applied by the last reorder, the particle now at index k was previously at get_particle_order()[k]
+	const std::vector<obj_idx>& get_particle_order() const
 	{
-		for (uint32_t idx{ start }; idx < end; ++idx) 
-		{
-			process_cell(idx, neighbour_positions_x[thread_idx], neighbour_positions_y[thread_idx]);
-		}
+		return particle_order_;
 	}
 
+	// the inverse permutation, the particle previously at index i is now at get_new_indices()[i]
+	const std::vector<obj_idx>& get_new_indices() const
+	{
+		return new_index_of_;
+	}
 
-	void solveCollisions()
+
+	void update_particles(const bool paused = false)
 	{
-		// Multi-thread render_grid_
-		const uint32_t thread_count = thread_pool.m_thread_count;
-		const uint32_t slice_size = (grid_cells_x * grid_cells_y) / thread_count;
-		const uint32_t last_cell = thread_count * slice_size;
+		refresh_turn_rates();
 
-		// Collision pass
-		for (uint32_t i = 0; i < thread_count; ++i)
+		// the fused step counts, turns, moves and wraps every particle in one pass over the arrays
+		fusing_step_ = fused_step && !paused;
+
+		if constexpr (neighbour_lists)
+		{
+			solve_with_neighbour_lists();
+		}
+		else
 		{
-			thread_pool.addTask([this, i, slice_size] 
+			if constexpr (position_format == PositionFormat::fixed16)
 			{
-				uint32_t const start = i * slice_size;
-				uint32_t const end = start + slice_size;
-				solveCollisionThreaded(start, end, i);
-			});
+				quantise_positions();
+			}
+
+			solveCollisions();
 		}
 
-		// process rest if the world is not divisible by the thread count
-		if (last_cell < grid_cells_x * grid_cells_y)
+		if (fusing_step_)
 		{
-			thread_pool.addTask([this, last_cell]
+			fusing_step_ = false;
+			particles_.positions_x.swap(next_positions_x_);
+			particles_.positions_y.swap(next_positions_y_);
+			neighbour_lists_.step();
+		}
+		else if (!paused)
+		{
+			if constexpr (storage_engine == StorageEngine::cell_resident)
 			{
-				solveCollisionThreaded(last_cell, grid_cells_x * grid_cells_y, 0);
-			});
+				update_resident_positions();
+			}
+			else
+			{
+				update_particle_positions();
+			}
+
+			neighbour_lists_.step();
 		}
 
-		thread_pool.waitForCompletion();
 	}
 
 
-
-	void process_cell(
-		const cell_idx cell_index,
-		std::array<float, cell_capacity * 9>& n_positions_x,
-		std::array<float, cell_capacity * 9>& n_positions_y)
+	// brings the flat particle arrays and the angles up to date for readers outside the step, like the renderer. the
+	// cell-resident engine keeps the current state in the cell blocks, and the angles are only needed for drawing
+	void sync_particle_store()
 	{
-		// for a given cell this function will access its particle contents. and for each one of them it will update them based off the information from the
-		// neighbouring 9 cells.
-		int neighbours_size = 0;
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			export_resident_particles();
+		}
+		refresh_angles();
+	}
+
 
-		const int cell_index_x = cell_index % grid_cells_x;
-		const int cell_index_y = cell_index / grid_cells_x;
-		const bool at_border_x = cell_index_x == 0 || cell_index_x == grid_cells_x - 1;
-		const bool at_border_y = cell_index_y == 0 || cell_index_y == grid_cells_y - 1;
+	// a fingerprint of the particle state, to check that two runs ended up in the same place. it sums a hash of every particle,
+	// so it does not depend on the order the particles are stored in
+	uint64_t state_hash()
+	{
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			export_resident_particles();
+		}
 
-		// each possible neighbour in the 3x3 area
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x - 1, cell_index_y - 1, true, true);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x    , cell_index_y - 1, false, true);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x + 1, cell_index_y - 1, true, true);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x - 1, cell_index_y    , true, false);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x    , cell_index_y    , false, false);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x + 1, cell_index_y    , true, false);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x - 1, cell_index_y + 1, true, true);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x    , cell_index_y + 1, false, true);
-		add_neighbour_cells_particles(n_positions_x, n_positions_y, neighbours_size, cell_index_x + 1, cell_index_y + 1, true, true);
+		const auto mix = [](uint64_t value)
+		{
+			// the splitmix64 finaliser
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+			return value ^ (value >> 31);
+		};
+
+		uint64_t hash = 0;
+		for (size_t i = 0; i < particles_.size(); ++i)
+		{
+			const uint64_t position = static_cast<uint64_t>(std::bit_cast<uint32_t>(particles_.positions_x[i])) << 32 | std::bit_cast<uint32_t>(particles_.positions_y[i]);
+			const uint64_t state = static_cast<uint64_t>(particles_.headings[i]) << 16 | particles_.neighbour_counts[i];
+			hash += mix(position ^ mix(state));
+		}
+		return hash;
+	}
 
-		// updating the particles
-		const auto& cell_contents = spatial_grid.grid[cell_index];
-		const uint8_t cell_size = spatial_grid.objects_count[cell_index];
 
-#pragma omp parallel for
-		for (uint8_t idx = 0; idx < cell_size; ++idx)
+	// counts the neighbours of every particle with both position formats and prints how often they disagree.
+	// nothing is updated, so it can be called at any point of a run
+	void report_fixed_point_accuracy()
+	{
+		if constexpr (storage_engine == StorageEngine::cell_resident)
 		{
-			update_particle(cell_contents[idx], at_border_x, at_border_y, n_positions_x, n_positions_y, neighbours_size);
+			std::cerr << "[ERROR]: the fixed-point accuracy report needs the index_grid storage engine\n";
 		}
+		else
+		{
+			FixedPointAccuracy accuracy;
+			NeighbourBuffer& buffer = neighbour_buffers_[0];
+			quantise_positions();
+
+			for (cell_idx cell_index = 0; cell_index < spatial_grid.total_cells; ++cell_index)
+			{
+				const bool at_border_x = is_border_column(cell_index % spatial_grid.cells_x);
+				const bool at_border_y = is_border_row(cell_index / spatial_grid.cells_x);
+
+				if (at_border_x)
+				{
+					at_border_y ? compare_position_formats<true, true>(cell_index, buffer, accuracy) : compare_position_formats<true, false>(cell_index, buffer, accuracy);
+				}
+				else
+				{
+					at_border_y ? compare_position_formats<false, true>(cell_index, buffer, accuracy) : compare_position_formats<false, false>(cell_index, buffer, accuracy);
+				}
+			}
 
+			std::cout << "[INFO]: fixed-point accuracy, scale " << fixed_scale_ << " units per world unit, " << accuracy.particles
+				<< " particles, neighbour count differs for " << accuracy.total_differs << " (by up to " << accuracy.max_total_difference
+				<< "), right-hand count for " << accuracy.right_differs << ", turning direction for " << accuracy.steering_differs << '\n';
+		}
 	}
 
 
-	inline void add_neighbour_cells_particles(
-		std::array<float, cell_capacity * 9>& n_positions_x,
-		std::array<float, cell_capacity * 9>& n_positions_y,
-		int& neighbours_size,
-		int32_t neighbour_index_x, int32_t neighbour_index_y,
-		bool check_x = true,
-		bool check_y = true)
+	// how evenly the collision passes since the last report were shared between the threads. the busy time of a thread is
+	// how long it ran cells and looked for more, the slowest one decides how long the pass took
+	void report_load_balance()
 	{
-		// Fast modulo for positive and negative numbers
-		if (check_x)
+		if (collision_passes_ == 0)
 		{
-			neighbour_index_x = neighbour_index_x >= 0 ?
-				(neighbour_index_x < grid_cells_x ? neighbour_index_x : neighbour_index_x - grid_cells_x) :
-				(neighbour_index_x + grid_cells_x);
+			std::cout << "[INFO]: no collision pass since the last load balance report\n";
+			return;
 		}
 
-		if (check_y)
+		const char* names[3] = { "static_slices", "stealing", "cost_weighted" };
+		const double passes = static_cast<double>(collision_passes_);
+		const uint64_t slowest = *std::max_element(collision_busy_ns_.begin(), collision_busy_ns_.end());
+		const double mean = static_cast<double>(std::accumulate(collision_busy_ns_.begin(), collision_busy_ns_.end(), uint64_t{ 0 }))
+			/ static_cast<double>(collision_busy_ns_.size());
+
+		std::cout << "[INFO]: collision pass load balance over " << collision_passes_ << " steps, " << names[static_cast<int>(load_balancing)]
+			<< ", " << static_cast<double>(collision_steals_) / passes << " steals per step\n";
+		for (size_t t = 0; t < collision_busy_ns_.size(); ++t)
 		{
-			neighbour_index_y = neighbour_index_y >= 0 ?
-				(neighbour_index_y < grid_cells_y ? neighbour_index_y : neighbour_index_y - grid_cells_y) :
-				(neighbour_index_y + grid_cells_y);
+			std::cout << "        thread " << t << ": busy " << static_cast<double>(collision_busy_ns_[t]) / passes * 1e-6 << " ms, "
+				<< static_cast<double>(collision_chunks_[t]) / passes << " chunks per step\n";
 		}
+		std::cout << "        slowest thread busy " << (mean > 0.0 ? static_cast<double>(slowest) / mean : 1.0) << "x the mean\n";
+
+		std::fill(collision_busy_ns_.begin(), collision_busy_ns_.end(), 0);
+		std::fill(collision_chunks_.begin(), collision_chunks_.end(), 0);
+		collision_steals_ = 0;
+		collision_passes_ = 0;
+	}
 
-		// fetching data for copying
-		const uint32_t neighbour_index = neighbour_index_y * grid_cells_x + neighbour_index_x;
-		const auto& contents = spatial_grid.grid[neighbour_index];
-		const auto size = spatial_grid.objects_count[neighbour_index];
 
-		// adding the neighbour data to the array
-#pragma omp parallel for
-		for (uint8_t idx = 0; idx < size; ++idx)
+	// which cpu and numa node every worker runs on, and whether the memory was placed next to them
+	void report_thread_placement()
+	{
+		const std::vector<tp::Placement> placements = thread_pool.placement();
+		std::cout << "[INFO]: thread placement, " << (threads_pinned_ ? "pinned" : "not pinned") << ", "
+			<< tp::allowedCpus().size() << " cpus available\n";
+		for (size_t t = 0; t < placements.size(); ++t)
 		{
-			const obj_idx object_index = contents[idx];
-			n_positions_x[neighbours_size] = positions_x_[object_index];
-			n_positions_y[neighbours_size] = positions_y_[object_index];
-			++neighbours_size;
+			std::cout << "        worker " << t << ": cpu " << placements[t].cpu << ", node " << placements[t].node;
+			if (threads_pinned_)
+			{
+				std::cout << " (pinned to cpu " << thread_pool.m_pinned_cpus[t] << ", node " << tp::cpuNode(thread_pool.m_pinned_cpus[t]) << ")";
+			}
+			std::cout << '\n';
 		}
+		std::cout << "        particle arrays and grid " << (memory_placed_ ? "first touched by their workers" : "placed by the main thread") << '\n';
+		report_page_backing();
 	}
 
-
-	inline void update_particle(const obj_idx index, const bool at_border_x, const bool at_border_y,
-		std::array<float, cell_capacity * 9>& n_positions_x,
-		std::array<float, cell_capacity * 9>& n_positions_y,
-		const int neighbours_size)
+	void report_page_backing()
 	{
-		// first fetch the data we need
-		float& x = positions_x_[index];
-		float& y = positions_y_[index];
-		float& angle = angles_[index];
+		PageBacking backing;
+		particles_.page_backing(backing);
+		spatial_grid.page_backing(backing);
+		if constexpr (fused_step)
+		{
+			backing.add(next_positions_x_);
+			backing.add(next_positions_y_);
+		}
 
-		// Convert angle to lookup table index
-		const int angle_index = static_cast<int>((angle / two_pi) * ANGLE_TABLE_SIZE) & (ANGLE_TABLE_SIZE - 1);
-		const float sin_angle = sin_table_[angle_index];
-		const float cos_angle = cos_table_[angle_index];
+		constexpr double megabyte = 1024.0 * 1024.0;
+		std::cout << "[INFO]: huge pages back " << backing.huge_bytes / megabyte << " of " << backing.bytes / megabyte
+			<< " MB of the particle arrays and grid" << (huge_pages ? "" : ", huge pages are turned off") << '\n';
+	}
 
-		// calculating the total and right particle count
-		int total_neighbours = 0;
-		int on_right_hemisphere = 0;
 
-		for (uint32_t i{ 0 }; i < neighbours_size; ++i)
-		{
-			float direction_x = n_positions_x[i] - x;
-			float direction_y = n_positions_y[i] - y;
+	// measures every trig mode against exact sin / cos: the worst error over all 65536 headings, how long the move pass
+	// takes with it, and how many particles would count a different right-hand side or turn the other way
+	void report_trig_modes()
+	{
+		TrigModeReport reports[3];
+		measure_trig_mode<TrigMode::table256>(reports[0]);
+		measure_trig_mode<TrigMode::interpolated_table>(reports[1]);
+		measure_trig_mode<TrigMode::polynomial>(reports[2]);
 
-			if (at_border_x)
+		if constexpr (storage_engine == StorageEngine::index_grid)
+		{
+			NeighbourBuffer& buffer = neighbour_buffers_[0];
+			for (cell_idx cell_index = 0; cell_index < spatial_grid.total_cells; ++cell_index)
 			{
-				direction_x -= world_width * fast_round(direction_x * inv_width_);
+				const bool at_border_x = is_border_column(cell_index % spatial_grid.cells_x);
+				const bool at_border_y = is_border_row(cell_index / spatial_grid.cells_x);
+
+				if (at_border_x)
+				{
+					at_border_y ? compare_trig_modes<true, true>(cell_index, buffer, reports) : compare_trig_modes<true, false>(cell_index, buffer, reports);
+				}
+				else
+				{
+					at_border_y ? compare_trig_modes<false, true>(cell_index, buffer, reports) : compare_trig_modes<false, false>(cell_index, buffer, reports);
+				}
 			}
+		}
 
-			if (at_border_y)
+		const char* names[3] = { "table256:           ", "interpolated_table: ", "polynomial:         " };
+		std::cout << "[INFO]: trig modes against exact sin / cos, currently using " << names[static_cast<int>(trig_mode)] << '\n';
+		for (int mode = 0; mode < 3; ++mode)
+		{
+			const TrigModeReport& report = reports[mode];
+			std::cout << "        " << names[mode] << "max error " << report.max_error << ", max heading error " << report.max_heading_error_degrees
+				<< " degrees, move pass " << report.move_ns_per_particle << " ns per particle";
+			if (report.particles > 0)
 			{
-				direction_y -= world_width * fast_round(direction_y * inv_height_);
+				std::cout << ", right-hand count differs for " << report.right_differs << " of " << report.particles
+					<< ", turning direction for " << report.steering_differs;
 			}
+			std::cout << '\n';
+		}
+		if constexpr (storage_engine != StorageEngine::index_grid)
+		{
+			std::cout << "        the steering comparison needs the index_grid storage engine\n";
+		}
+	}
+
 
-			const float dist_sq = direction_x * direction_x + direction_y * direction_y;
 
-			if (dist_sq > 0 && dist_sq < visual_radius * visual_radius)
+
+private:
+	void init_thread_placement()
+	{
+		if constexpr (pin_threads)
+		{
+			threads_pinned_ = thread_pool.pinThreads();
+			if (!threads_pinned_)
 			{
-				on_right_hemisphere += (direction_x * sin_angle - direction_y * cos_angle) < 0;
-				++total_neighbours;
+				std::cout << "[INFO]: the threads are not pinned, the process may only use " << tp::allowedCpus().size()
+					<< " cpus for " << threads << " threads\n";
 			}
 		}
+	}
+
+	// the arrays are still all zero here. their pages are handed back and faulted in again by the threads that will work on
+	// them, so each part lands on the numa node of its thread. pinning keeps the threads there afterwards
+	void first_touch_memory()
+	{
+		if constexpr (!pin_threads)
+		{
+			return;
+		}
+
+		memory_placed_ = spatial_grid.first_touch(particles_.size(), thread_pool);
+		memory_placed_ &= particles_.first_touch(thread_pool);
+		if constexpr (fused_step)
+		{
+			memory_placed_ &= tp::firstTouch(next_positions_x_, thread_pool);
+			memory_placed_ &= tp::firstTouch(next_positions_y_, thread_pool);
+		}
+		if constexpr (position_format == PositionFormat::fixed16)
+		{
+			memory_placed_ &= tp::firstTouch(fixed_positions_x_, thread_pool);
+			memory_placed_ &= tp::firstTouch(fixed_positions_y_, thread_pool);
+		}
+	}
+
+
+	void init_neighbour_kernel()
+	{
+		const char* kernel_name = "";
+		neighbour_kernels_ = select_neighbour_kernels(kernel_name);
+		std::cout << "[INFO]: using the " << kernel_name << " neighbour kernel\n";
+
+		kernel_params_ = { visual_radius * visual_radius, world_width_, world_height_, inv_width_, inv_height_ };
+
+		// two particles of a neighbourhood are at most 2 * reach cells apart, plus how far both can drift before the grid is rebuilt.
+		// the tuned grids keep reach * cell size just above the visual radius, the starting grid may use slightly larger cells.
+		// a pair more than 65536 units minus the visual radius apart would alias onto a neighbour
+		fixed_scale_ = 65536.f * static_cast<float>(fixed_wraps_x) / world_width_;
+		const float cell_width = world_width_ / static_cast<float>(spatial_grid.cells_x);
+		const float widest_neighbourhood = 2.f * std::max(static_cast<float>(stencil_reach_) * cell_width, visual_radius / (1.f - visual_radius / world_height_))
+			+ 2.f * add_to_grid_freq * gamma + visual_radius;
+		if (position_format == PositionFormat::fixed16 && widest_neighbourhood * fixed_scale_ >= 65536.f)
+		{
+			throw std::invalid_argument("the world is too small for fixed-point positions, the coordinates would wrap within a neighbourhood");
+		}
+
+		const double fixed_radius = static_cast<double>(visual_radius) * fixed_scale_;
+		fixed_radius_sq_ = static_cast<int32_t>(std::min(fixed_radius * fixed_radius, 2147483647.0));
+	}
+
+	// the arrays are usually in cell order, dropping the last particles would empty one part of the world. a partial shuffle
+	// picks the particles to remove at random, the rest keep their order
+	void remove_random_particles(const size_t count)
+	{
+		const size_t previous_count = particles_.size();
+		particle_order_.resize(previous_count);
+		std::iota(particle_order_.begin(), particle_order_.end(), obj_idx{ 0 });
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::swap(particle_order_[i], particle_order_[Random::rand_range(i, previous_count - 1)]);
+		}
+		particle_order_.erase(particle_order_.begin(), particle_order_.begin() + static_cast<std::ptrdiff_t>(count));
+		std::sort(particle_order_.begin(), particle_order_.end());
+
+		particles_.permute(particle_order_, new_index_of_, thread_pool);
+		beacons.remap(new_index_of_);
+	}
+
+	void reorder_particles_by_cell()
+	{
+		// the grid lists every particle in cell order, so it is exactly the permutation to apply
+		spatial_grid.cell_order(particle_order_, thread_pool);
+		particles_.permute(particle_order_, new_index_of_, thread_pool);
+
+		spatial_grid.relabel_in_cell_order(thread_pool);
+		beacons.remap(new_index_of_);
+		particles_sorted_ = true;
+	}
+
+	struct GridCandidate
+	{
+		int reach = 1;
+		uint32_t cells_x = 0;
+		uint32_t cells_y = 0;
+		double milliseconds = 0.0;
+	};
+
+	// the cells are just wide enough for `reach` of them to cover the visual radius. a grid of fewer than 2 * reach + 1 cells
+	// gets larger cells, then a smaller reach covers the radius
+	GridCandidate grid_for_reach(const int reach) const
+	{
+		GridCandidate candidate;
+		candidate.cells_x = std::max(2u * reach + 1u, static_cast<uint32_t>(world_width_ * reach / visual_radius));
+		candidate.cells_y = std::max(2u * reach + 1u, static_cast<uint32_t>(world_height_ * reach / visual_radius));
+		candidate.reach = stencil_reach_for(candidate.cells_x, candidate.cells_y);
+		return candidate;
+	}
+
+	// how many cells the stencil has to reach out on each side, so it covers the visual radius from anywhere in a cell
+	int stencil_reach_for(const uint32_t cells_x, const uint32_t cells_y) const
+	{
+		const float cell_size = std::min(spatial_grid.m_worldSize.x / static_cast<float>(cells_x), spatial_grid.m_worldSize.y / static_cast<float>(cells_y));
+		return static_cast<int>(std::ceil(visual_radius / cell_size));
+	}
+
+	// a stencil wider than the grid would reach the same cells from both sides of the world and count their particles twice
+	bool fits_stencil(const uint32_t cells_x, const uint32_t cells_y) const
+	{
+		const auto stencil_width = static_cast<uint32_t>(2 * stencil_reach_for(cells_x, cells_y) + 1);
+		return stencil_width <= cells_x && stencil_width <= cells_y;
+	}
+
+	// the grid of the config, unless its cells are so small that the stencil covering the visual radius no longer fits in the
+	// world. then the grid starts from cells just wider than the visual radius, as the tuner's r/1 grid. a deterministic run
+	// never tunes the grid, so it always keeps the r/1 grid whatever the config asks for
+	void init_grid_resolution(const PopulationConfig& config)
+	{
+		uint32_t cells_x = config.cells_x();
+		uint32_t cells_y = config.cells_y();
+		if constexpr (deterministic)
+		{
+			const GridCandidate grid = grid_for_reach(1);
+			cells_x = grid.cells_x;
+			cells_y = grid.cells_y;
+		}
+		if (!fits_stencil(cells_x, cells_y))
+		{
+			const GridCandidate fallback = grid_for_reach(1);
+			std::cerr << "[ERROR]: a grid of " << cells_x << 'x' << cells_y << " cells needs a stencil wider than the world to cover the visual radius, using "
+				<< fallback.cells_x << 'x' << fallback.cells_y << " cells\n";
+			cells_x = fallback.cells_x;
+			cells_y = fallback.cells_y;
+		}
+		if (!fits_stencil(cells_x, cells_y))
+		{
+			throw std::invalid_argument("the world is too small for the visual radius, the stencil would count particles twice");
+		}
+
+		spatial_grid.resize(cells_x, cells_y);
+		stencil_reach_ = stencil_reach_for(cells_x, cells_y);
+	}
+
+	void set_grid_resolution(const GridCandidate& candidate)
+	{
+		// the particles are no longer in cell order for the new cells until the grid is rebuilt
+		spatial_grid.resize(candidate.cells_x, candidate.cells_y);
+		stencil_reach_ = stencil_reach_for(candidate.cells_x, candidate.cells_y);
+		particles_sorted_ = false;
+		init_halo();
+
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			wrap_positions();
+			resident_particles_.load(spatial_grid, particles_.positions_x.data(), particles_.positions_y.data(), particles_.headings.data(), particles_.neighbour_counts.data(), particles_.size());
+			resize_neighbour_buffers(resident_particles_.max_cell_size());
+		}
+		else
+		{
+			add_particles_to_grid();
+		}
+	}
+
+	double time_grid_resolution()
+	{
+		// the collision passes steer the particles, so the headings are put back afterwards. the grid has just been built,
+		// its share of the cost is one rebuild every add_to_grid_freq steps
+		using clock = std::chrono::steady_clock;
+		const auto build_start = clock::now();
+		add_particles_to_grid();
+		const auto build_end = clock::now();
+
+		const ParticleStore::Column<uint16_t> saved_headings = particles_.headings;
+		const ParticleStore::Column<uint16_t> saved_neighbour_counts = particles_.neighbour_counts;
+
+		for (int step = 0; step < grid_tuning_steps; ++step)
+		{
+			if constexpr (position_format == PositionFormat::fixed16)
+			{
+				quantise_positions();
+			}
+			solveCollisions();
+		}
+		const auto collisions_end = clock::now();
+
+		particles_.headings = saved_headings;
+		particles_.neighbour_counts = saved_neighbour_counts;
+
+		const std::chrono::duration<double, std::milli> build = build_end - build_start;
+		const std::chrono::duration<double, std::milli> collisions = collisions_end - build_end;
+		return build.count() / add_to_grid_freq + collisions.count() / grid_tuning_steps;
+	}
+
+	// cells within the stencil's reach of the border need their neighbour indices and distances wrapped. when the positions are
+	// wrapped every step, the particles of the edge cells may already sit on the far side of the world until the next rebuild,
+	// as deep as they drifted since, so the cells that far in need wrapped distances as well (drift_border_)
+	uint32_t border_width() const
+	{
+		return static_cast<uint32_t>(stencil_reach_) + drift_border_;
+	}
+
+	bool is_border_column(const uint32_t cell_x) const
+	{
+		return cell_x < border_width() || cell_x >= spatial_grid.cells_x - border_width();
+	}
+
+	bool is_border_row(const uint32_t cell_y) const
+	{
+		return cell_y < border_width() || cell_y >= spatial_grid.cells_y - border_width();
+	}
+
+	void migrate_resident_particles()
+	{
+		// the first call moves the particles into the cell blocks, afterwards only the ones which changed cell are moved
+		if (!resident_particles_.loaded())
+		{
+			wrap_positions();
+			resident_particles_.load(spatial_grid, particles_.positions_x.data(), particles_.positions_y.data(), particles_.headings.data(), particles_.neighbour_counts.data(), particles_.size());
+		}
+		else
+		{
+			resident_particles_.migrate(spatial_grid, world_width_, world_height_, thread_pool);
+		}
+
+		resize_neighbour_buffers(resident_particles_.max_cell_size());
+	}
+
+	void export_resident_particles()
+	{
+		// the renderer and beacons read the flat arrays, and the beacons search through the spatial grid
+		if (!resident_particles_.loaded())
+		{
+			return;
+		}
+
+		resident_particles_.export_to(particles_.positions_x.data(), particles_.positions_y.data(), particles_.headings.data(), particles_.neighbour_counts.data(), thread_pool);
+
+		// the blocks are only wrapped when they migrate, the grid needs positions inside the world
+		wrap_positions();
+		spatial_grid.build(particles_.positions_x.data(), particles_.positions_y.data(), particles_.size(), thread_pool);
+	}
+
+	void resize_neighbour_buffers(const uint32_t max_cell_size)
+	{
+		// a neighbourhood can never hold more than one densest cell per cell of the stencil. a row sweep keeps every column
+		// strip of its row, which is up to cells_x + 2 * reach strips of stencil_width cells
+		const size_t stencil_width = 2 * stencil_reach_ + 1;
+		const size_t stencil_cells = row_sweep ? (spatial_grid.cells_x + 2 * stencil_reach_) * stencil_width : stencil_width * stencil_width;
+		reserve_neighbour_buffers(static_cast<size_t>(max_cell_size) * stencil_cells);
+	}
+
+	void reserve_neighbour_buffers(const size_t required_size)
+	{
+		// besides the buffers the arena keeps room for the strip starts of a row sweep
+		const size_t row_capacity = std::max<size_t>(scratch_row_capacity_, spatial_grid.cells_x + 2 * stencil_reach_ + 1);
+		const bool rows_fit = row_capacity == scratch_row_capacity_;
+		scratch_row_capacity_ = row_capacity;
+
+		// every thread grows its own arena, so it is allocated and first touched on the thread's numa node. an arena that a
+		// step had to chain extra blocks onto is merged back into one block here too
+		thread_pool.parallel([this, required_size, row_capacity, rows_fit](const uint32_t t)
+		{
+			NeighbourBuffer& buffer = neighbour_buffers_[t];
+			ScratchArena& arena = scratch_arenas_[t];
+			if (buffer.capacity >= required_size && rows_fit && arena.overflow_count == 0)
+			{
+				return;
+			}
+
+			const size_t capacity = std::max(required_size, buffer.capacity);
+			const size_t line = ScratchArena::alignment;
+			arena.reserve(2 * (capacity * sizeof(float) + line) + 2 * ((capacity + fixed_kernel_padding) * sizeof(int16_t) + line)
+				+ row_capacity * sizeof(int) + line);
+			arena.overflow_count = 0;
+
+			buffer.positions_x = arena.allocate<float>(capacity);
+			buffer.positions_y = arena.allocate<float>(capacity);
+			buffer.fixed_x = arena.allocate<int16_t>(capacity + fixed_kernel_padding);
+			buffer.fixed_y = arena.allocate<int16_t>(capacity + fixed_kernel_padding);
+			buffer.capacity = capacity;
+			buffer.scratch = &arena;
+		});
+	}
+
+	void init_halo()
+	{
+		// halo line -1 copies the last line shifted back by the world size, line `cells` copies the first shifted forward.
+		// when the positions are wrapped every step the border cells wrap their distances anyway, and shifting as well would
+		// only add rounding
+		const auto fill = [this](std::vector<HaloLine>& lines, const int cells, const float world_size)
+		{
+			lines.resize(cells + 2 * stencil_reach_);
+			for (int line = -stencil_reach_; line < cells + stencil_reach_; ++line)
+			{
+				const int wraps = (line >= cells) - (line < 0);
+				const float shift = wrapped_every_step ? 0.f : static_cast<float>(wraps) * world_size;
+				lines[line + stencil_reach_] = { static_cast<uint32_t>(line - wraps * cells), shift };
+			}
+		};
+
+		fill(halo_columns_, static_cast<int>(spatial_grid.cells_x), world_width_);
+		fill(halo_rows_, static_cast<int>(spatial_grid.cells_y), world_height_);
+
+		// a particle moves at most gamma per step, and the incremental grid puts it back in its cell every step
+		const float drift = static_cast<float>(incremental_grid ? 1 : add_to_grid_freq) * gamma;
+		const float cell_size = std::min(spatial_grid.m_cellSize.x, spatial_grid.m_cellSize.y);
+		drift_border_ = wrapped_every_step ? static_cast<uint32_t>(std::ceil(drift / cell_size)) : 0u;
+	}
+
+	void init_particle_vectors(const size_t particle_count)
+	{
+		particles_.resize(particle_count);
+		resize_particle_buffers();
+	}
+
+	// resizing vectors to the population size. the fused step's positions are swapped with the store's, so they are padded the same
+	void resize_particle_buffers()
+	{
+		next_positions_x_.resize(fused_step ? particles_.padded_size() : 0);
+		next_positions_y_.resize(fused_step ? particles_.padded_size() : 0);
+		fixed_positions_x_.resize(particles_.size());
+		fixed_positions_y_.resize(particles_.size());
+	}
+
+	void randomize_angles()
+	{
+		for (size_t i = 0; i < particles_.size(); ++i)
+		{
+			particles_.headings[i] = to_binary_angle(Random::rand_range(0.f, 2.f * pi));
+		}
+	}
+
+
+	static uint16_t to_binary_angle(const float radians)
+	{
+		return static_cast<uint16_t>(static_cast<int32_t>(radians * binary_angles_per_radian));
+	}
+
+	void refresh_turn_rates()
+	{
+		// the update rules are in degrees and can change at any time, they are converted to binary angles only when they do
+		if (UpdateRules::alpha == turn_rules_alpha_ && UpdateRules::beta == turn_rules_beta_)
+		{
+			return;
+		}
+
+		turn_rules_alpha_ = UpdateRules::alpha;
+		turn_rules_beta_ = UpdateRules::beta;
+		turn_alpha_ = static_cast<int32_t>(std::lround(UpdateRules::alpha * binary_angles_per_degree));
+		turn_beta_ = static_cast<int32_t>(std::lround(UpdateRules::beta * binary_angles_per_degree));
+	}
+
+	void refresh_angles()
+	{
+		thread_pool.dispatch(static_cast<uint32_t>(particles_.size()), [this](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t i = start; i < end; ++i)
+			{
+				particles_.angles[i] = static_cast<float>(particles_.headings[i]) * (two_pi / 65536.f);
+			}
+		});
+	}
+
+	void update_resident_positions()
+	{
+		// the same update as update_particle_positions, streamed through the cell blocks
+		thread_pool.dispatch(static_cast<uint32_t>(spatial_grid.total_cells), [this](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t cell_index = start; cell_index < end; ++cell_index)
+			{
+				uint32_t remaining = resident_particles_.cell_size(cell_index);
+				for (auto* block = &resident_particles_.head(cell_index); remaining > 0; block = resident_particles_.next(*block))
+				{
+					const uint32_t count = std::min<uint32_t>(remaining, cell_block_width);
+					trig_.advance<trig_mode>(block->x, block->y, block->heading, count, gamma);
+					remaining -= count;
+				}
+			}
+		});
+	}
+
+	void update_particle_positions()
+	{
+		// updating the positions of each particles in the direction of their angle by step size `gamma`
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const int particles_per_thread = static_cast<int>(particles_.size() / thread_count);
+		const int last_thread_particles = static_cast<int>(particles_.size()) - (thread_count - 1) * particles_per_thread;
+
+		thread_pool.parallel([this, particles_per_thread, last_thread_particles, thread_count](const uint32_t t) {
+			const int start = t * particles_per_thread;
+			const int end = (t == thread_count - 1) ? start + last_thread_particles : start + particles_per_thread;
+
+			// Update position, the heading is always within one turn
+			trig_.advance<trig_mode>(particles_.positions_x.data() + start, particles_.positions_y.data() + start, particles_.headings.data() + start, end - start, gamma);
+			});
+	}
+
+
+	void solve_with_neighbour_lists()
+	{
+		// every particle gathers the positions in its own list, the kernel only wraps for particles whose list crosses the border.
+		// the lists of particles in dense clusters are far longer, so the work is claimed in chunks and rebalanced by stealing
+		const uint32_t grain = load_balancing == LoadBalancing::static_slices ? static_cast<uint32_t>(particles_.size()) : list_chunk_size;
+		thread_pool.dispatchStealing(static_cast<uint32_t>(particles_.size()), grain,
+			[this](const uint32_t start, const uint32_t end, const uint32_t worker) {
+				NeighbourBuffer& buffer = neighbour_buffers_[worker];
+
+				for (uint32_t i = start; i < end; ++i)
+				{
+					const obj_idx* list = neighbour_lists_.indices.data() + neighbour_lists_.list_start[i];
+					const int list_size = static_cast<int>(neighbour_lists_.list_size[i]);
+					for (int k = 0; k < list_size; ++k)
+					{
+						buffer.positions_x[k] = particles_.positions_x[list[k]];
+						buffer.positions_y[k] = particles_.positions_y[list[k]];
+					}
+
+					const uint8_t flags = neighbour_lists_.border_flags[i];
+					update_particle(i, neighbour_kernels_.kernels[flags & 1][flags >> 1], buffer.positions_x, buffer.positions_y, list_size);
+				}
+			});
+		record_collision_telemetry();
+	}
+
+
+	void solveCollisionThreaded(uint32_t start, uint32_t end, int thread_idx)
+	{
+		NeighbourBuffer& buffer = neighbour_buffers_[thread_idx];
+
+		// the slice is walked one row at a time, so the interior run of each row can be dispatched to the kernel without wrapping
+		const uint32_t cells_x = spatial_grid.cells_x;
+		while (start < end)
+		{
+			const uint32_t cell_index_y = start / cells_x;
+			const uint32_t row_end = std::min<uint32_t>((cell_index_y + 1) * cells_x, end);
+
+			if (is_border_row(cell_index_y))
+			{
+				process_row<true>(start, row_end, buffer);
+			}
+			else
+			{
+				process_row<false>(start, row_end, buffer);
+			}
+
+			start = row_end;
+		}
+	}
+
+
+	template<bool AtBorderY>
+	void process_row(const uint32_t start, const uint32_t end,
+		NeighbourBuffer& buffer)
+	{
+		if constexpr (row_sweep)
+		{
+			sweep_row<AtBorderY>(start, end, buffer);
+			return;
+		}
+
+		// [start, end) lies within a single row. the first and last border_width() cells of the row are on the x border
+		const uint32_t cells_x = spatial_grid.cells_x;
+		const uint32_t row_start = (start / cells_x) * cells_x;
+		const uint32_t interior_start = std::min(std::max(start, row_start + border_width()), end);
+		const uint32_t interior_end = std::max(std::min<uint32_t>(end, row_start + cells_x - border_width()), interior_start);
+
+		for (uint32_t idx{ start }; idx < interior_start; ++idx)
+		{
+			process_cell<true, AtBorderY>(idx, buffer);
+		}
+
+		for (uint32_t idx{ interior_start }; idx < interior_end; ++idx)
+		{
+			process_cell<false, AtBorderY>(idx, buffer);
+		}
+
+		for (uint32_t idx{ interior_end }; idx < end; ++idx)
+		{
+			process_cell<true, AtBorderY>(idx, buffer);
+		}
+	}
+
+
+	template<bool AtBorderY>
+	void sweep_row(const uint32_t start, const uint32_t end,
+		NeighbourBuffer& buffer)
+	{
+		// [start, end) lies within a single row. the neighbourhood of cell x is the window of column strips x - reach .. x + reach,
+		// a strip being the stencil_width cells of one column around the row. the strips are appended one after another, so
+		// the window is always one contiguous run of the buffer, and moving one cell along only gathers the strip entering it
+		const int cells_x = static_cast<int>(spatial_grid.cells_x);
+		const int cell_index_y = static_cast<int>(start) / cells_x;
+		const int first_x = static_cast<int>(start) - cell_index_y * cells_x;
+		const int end_x = static_cast<int>(end) - cell_index_y * cells_x;
+		const int window_width = 2 * stencil_reach_ + 1;
+
+		// where each column strip starts in the buffer, one past the end for the last
+		ScratchArena& scratch = *buffer.scratch;
+		const ScratchArena::Mark scratch_mark = scratch.mark();
+		int* strip_starts = scratch.allocate<int>(end_x - first_x + window_width);
+		strip_starts[0] = 0;
+		int neighbours_size = 0;
+
+		// the strips left of the first cell, and its own column
+		for (int strip = 0; strip < window_width - 1; ++strip)
+		{
+			gather_column_strip(first_x - stencil_reach_ + strip, cell_index_y, buffer, neighbours_size);
+			strip_starts[strip + 1] = neighbours_size;
+		}
+
+		for (int cell_x = first_x; cell_x < end_x; ++cell_x)
+		{
+			// the strip entering on the right. the one after it is prefetched so it is in cache when the window next moves
+			const int window_start = cell_x - first_x;
+			gather_column_strip(cell_x + stencil_reach_, cell_index_y, buffer, neighbours_size);
+			strip_starts[window_start + window_width] = neighbours_size;
+			if (cell_x + 1 < end_x)
+			{
+				prefetch_column_strip(cell_x + stencil_reach_ + 1, cell_index_y);
+			}
+
+			const cell_idx cell_index = start + window_start;
+			if (cell_population(cell_index) == 0)
+			{
+				continue;
+			}
+
+			const int first = strip_starts[window_start];
+			if (is_border_column(cell_x))
+			{
+				update_cell_particles<true, AtBorderY>(cell_index, buffer, first, neighbours_size - first);
+			}
+			else
+			{
+				update_cell_particles<false, AtBorderY>(cell_index, buffer, first, neighbours_size - first);
+			}
+		}
+
+		scratch.rewind(scratch_mark);
+	}
+
+	void gather_column_strip(const int column, const int cell_index_y, NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		// the strips of the first and last cells of a row reach into the halo
+		for (int offset_y = -stencil_reach_; offset_y <= stencil_reach_; ++offset_y)
+		{
+			append_cell_neighbours(column, cell_index_y + offset_y, buffer, neighbours_size);
+		}
+	}
+
+	void prefetch_column_strip(const int column, const int cell_index_y)
+	{
+		// only the first line of each cell, the hardware prefetcher follows the runs from there
+		for (int offset_y = -stencil_reach_; offset_y <= stencil_reach_; ++offset_y)
+		{
+			const cell_idx neighbour_index = halo_cell(column, cell_index_y + offset_y);
+
+			if constexpr (storage_engine == StorageEngine::cell_resident)
+			{
+				_mm_prefetch(reinterpret_cast<const char*>(&resident_particles_.head(neighbour_index)), _MM_HINT_T0);
+			}
+			else if (!particles_sorted_)
+			{
+				_mm_prefetch(reinterpret_cast<const char*>(spatial_grid.cell_contents(neighbour_index)), _MM_HINT_T0);
+			}
+			else if constexpr (position_format == PositionFormat::fixed16)
+			{
+				_mm_prefetch(reinterpret_cast<const char*>(fixed_positions_x_.data() + spatial_grid.sorted_start[neighbour_index]), _MM_HINT_T0);
+				_mm_prefetch(reinterpret_cast<const char*>(fixed_positions_y_.data() + spatial_grid.sorted_start[neighbour_index]), _MM_HINT_T0);
+			}
+			else
+			{
+				_mm_prefetch(reinterpret_cast<const char*>(particles_.positions_x.data() + spatial_grid.sorted_start[neighbour_index]), _MM_HINT_T0);
+				_mm_prefetch(reinterpret_cast<const char*>(particles_.positions_y.data() + spatial_grid.sorted_start[neighbour_index]), _MM_HINT_T0);
+			}
+		}
+	}
+
+	uint32_t cell_population(const cell_idx cell_index) const
+	{
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			return resident_particles_.cell_size(cell_index);
+		}
+		return spatial_grid.objects_count[cell_index];
+	}
+
+
+	void solveCollisions()
+	{
+		// Collision pass. the cost of a cell grows with the square of the density around it, so a static slice holding a dense
+		// cluster would keep the whole step waiting. the cells are claimed a row at a time instead, and threads that run out
+		// steal from the busiest ones. each thread keeps its own neighbour buffer whichever rows it ends up with
+		const uint32_t total_cells = static_cast<uint32_t>(spatial_grid.total_cells);
+		const uint32_t grain = load_balancing == LoadBalancing::static_slices ? total_cells : spatial_grid.cells_x;
+		const uint32_t* splits = nullptr;
+		if constexpr (load_balancing == LoadBalancing::cost_weighted)
+		{
+			// the populations change little from one step to the next, and stealing evens out what the estimate misses
+			if (++steps_since_weighing_ >= static_cast<uint32_t>(add_to_grid_freq) || collision_splits_.empty() || collision_splits_.back() != total_cells)
+			{
+				weigh_collision_rows();
+				steps_since_weighing_ = 0;
+			}
+			splits = collision_splits_.data();
+		}
+
+		thread_pool.dispatchStealing(total_cells, grain,
+			[this](const uint32_t start, const uint32_t end, const uint32_t worker)
+			{
+				solveCollisionThreaded(start, end, static_cast<int>(worker));
+			}, splits);
+		record_collision_telemetry();
+	}
+
+
+	// splitting the cells so every thread starts with about the same cost, estimated from the populations of the last grid build.
+	// a cell tests every particle in it against its whole stencil, about population * stencil population distance tests, and
+	// looking up the stencil cells costs about as much as another gather_cost_per_cell tests each. an empty cell is only checked
+	void weigh_collision_rows()
+	{
+		// measured: a sparse cell of one or two particles takes about as long as 300 distance tests with a 3 x 3 stencil
+		constexpr uint32_t gather_cost_per_cell = 32;
+		const uint32_t stencil_width = 2 * stencil_reach_ + 1;
+		const uint32_t gather_cost = gather_cost_per_cell * stencil_width * stencil_width;
+
+		const uint32_t cells_x = spatial_grid.cells_x;
+		const uint32_t cells_y = spatial_grid.cells_y;
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		column_populations_.resize(spatial_grid.total_cells);
+		cell_costs_.resize(spatial_grid.total_cells);
+		row_costs_.resize(cells_y);
+		collision_splits_.resize(thread_count + 1);
+
+		// the stencil population is summed in two passes, first over the rows of the stencil then over its columns
+		thread_pool.dispatch(cells_y, [this, cells_x](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t row = start; row < end; ++row)
+			{
+				for (uint32_t column = 0; column < cells_x; ++column)
+				{
+					uint32_t population = 0;
+					for (int offset_y = -stencil_reach_; offset_y <= stencil_reach_; ++offset_y)
+					{
+						population += cell_population(halo_cell(static_cast<int>(column), static_cast<int>(row) + offset_y));
+					}
+					column_populations_[row * cells_x + column] = population;
+				}
+			}
+		});
+
+		thread_pool.dispatch(cells_y, [this, cells_x, gather_cost](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t row = start; row < end; ++row)
+			{
+				uint64_t row_cost = 0;
+				for (uint32_t column = 0; column < cells_x; ++column)
+				{
+					const cell_idx cell_index = row * cells_x + column;
+					const uint32_t population = cell_population(cell_index);
+					uint32_t stencil_population = 0;
+					for (int offset_x = -stencil_reach_; offset_x <= stencil_reach_; ++offset_x)
+					{
+						stencil_population += column_populations_[row * cells_x + halo_columns_[column + offset_x + stencil_reach_].index];
+					}
+					cell_costs_[cell_index] = population == 0 ? 1 : population * stencil_population + gather_cost;
+					row_cost += cell_costs_[cell_index];
+				}
+				row_costs_[row] = row_cost;
+			}
+		});
+
+		// a thread's slice starts at the first cell where the running cost reaches its share of the total. whole rows are
+		// skipped first, the row the share ends in is walked cell by cell
+		const uint64_t total_cost = std::accumulate(row_costs_.begin(), row_costs_.end(), uint64_t{ 0 });
+		uint64_t running_cost = 0;
+		uint32_t cell_index = 0;
+		for (uint32_t t = 0; t < thread_count; ++t)
+		{
+			const uint64_t slice_start_cost = total_cost * t / thread_count;
+			while (cell_index < spatial_grid.total_cells)
+			{
+				if (cell_index % cells_x == 0 && running_cost + row_costs_[cell_index / cells_x] <= slice_start_cost)
+				{
+					running_cost += row_costs_[cell_index / cells_x];
+					cell_index += cells_x;
+				}
+				else if (running_cost + cell_costs_[cell_index] <= slice_start_cost)
+				{
+					running_cost += cell_costs_[cell_index++];
+				}
+				else
+				{
+					break;
+				}
+			}
+			collision_splits_[t] = cell_index;
+		}
+		collision_splits_[thread_count] = static_cast<uint32_t>(spatial_grid.total_cells);
+	}
+
+
+	void record_collision_telemetry()
+	{
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		collision_busy_ns_.resize(thread_count);
+		collision_chunks_.resize(thread_count);
+		for (uint32_t t = 0; t < thread_count; ++t)
+		{
+			collision_busy_ns_[t] += thread_pool.m_telemetry[t].m_busy_ns;
+			collision_chunks_[t] += thread_pool.m_telemetry[t].m_chunks;
+		}
+		collision_steals_ += thread_pool.m_steal_count;
+		++collision_passes_;
+	}
+
+
+
+	template<bool AtBorderX, bool AtBorderY>
+	void process_cell(
+		const cell_idx cell_index,
+		NeighbourBuffer& buffer)
+	{
+		// for a given cell this function will access its particle contents. and for each one of them it will update them based off the information from the
+		// neighbouring cells of the stencil
+
+		// nothing to update, and with fine grids most cells are empty
+		if (cell_population(cell_index) == 0)
+		{
+			return;
+		}
+
+		const int neighbours_size = gather_neighbours<AtBorderX>(cell_index, buffer);
+		update_cell_particles<AtBorderX, AtBorderY>(cell_index, buffer, 0, neighbours_size);
+	}
+
+
+	template<bool AtBorderX, bool AtBorderY>
+	void update_cell_particles(const cell_idx cell_index, NeighbourBuffer& buffer, const int first, const int neighbours_size)
+	{
+		// the particles of the cell against the neighbours gathered into buffer[first, first + neighbours_size)
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			// updated in place inside their blocks
+			const neighbour_kernel_fn count_neighbours = grid_kernel<AtBorderX, AtBorderY>();
+			uint32_t remaining = resident_particles_.cell_size(cell_index);
+
+			for (auto* block = &resident_particles_.head(cell_index); remaining > 0; block = resident_particles_.next(*block))
+			{
+				const uint32_t count = std::min<uint32_t>(remaining, cell_block_width);
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					update_heading(block->x[i], block->y[i], block->heading[i], block->neighbours[i],
+						count_neighbours, buffer.positions_x + first, buffer.positions_y + first, neighbours_size);
+				}
+				remaining -= count;
+			}
+			return;
+		}
+
+		const obj_idx* cell_contents = spatial_grid.cell_contents(cell_index);
+		const uint32_t cell_size = spatial_grid.objects_count[cell_index];
+
+		if constexpr (position_format == PositionFormat::fixed16)
+		{
+			// the coordinates wrap with the world, so one kernel serves every cell
+			for (uint32_t idx = 0; idx < cell_size; ++idx)
+			{
+				const obj_idx index = cell_contents[idx];
+				steer(particles_.headings[index], particles_.neighbour_counts[index],
+					count_fixed_neighbours(index, buffer.fixed_x + first, buffer.fixed_y + first, neighbours_size));
+
+				if (fusing_step_)
+				{
+					move_to_next_position(index);
+				}
+			}
+		}
+		else
+		{
+			const neighbour_kernel_fn count_neighbours = grid_kernel<AtBorderX, AtBorderY>();
+			for (uint32_t idx = 0; idx < cell_size; ++idx)
+			{
+				update_particle(cell_contents[idx], count_neighbours, buffer.positions_x + first, buffer.positions_y + first, neighbours_size);
+			}
+		}
+	}
+
+
+	template<bool AtBorderX, PositionFormat Format = position_format>
+	int gather_neighbours(const cell_idx cell_index, NeighbourBuffer& buffer)
+	{
+		int neighbours_size = 0;
+
+		const int cells_x = static_cast<int>(spatial_grid.cells_x);
+		const int cell_index_x = cell_index % cells_x;
+		const int cell_index_y = cell_index / cells_x;
+
+		// each possible neighbour in the stencil, one row at a time. once the particles are sorted by cell, the cells of a row
+		// which does not reach into the halo on the x axis are stored back to back and can be copied as a single run
+		for (int offset_y = -stencil_reach_; offset_y <= stencil_reach_; ++offset_y)
+		{
+			if (!AtBorderX && particles_sorted_)
+			{
+				add_neighbour_row_run<Format>(cell_index_x, cell_index_y + offset_y, buffer, neighbours_size);
+				continue;
+			}
+
+			for (int offset_x = -stencil_reach_; offset_x <= stencil_reach_; ++offset_x)
+			{
+				append_cell_neighbours<Format>(cell_index_x + offset_x, cell_index_y + offset_y, buffer, neighbours_size);
+			}
+		}
+
+		return neighbours_size;
+	}
+
+
+	cell_idx halo_cell(const int halo_x, const int halo_y) const
+	{
+		return halo_rows_[halo_y + stencil_reach_].index * spatial_grid.cells_x + halo_columns_[halo_x + stencil_reach_].index;
+	}
+
+	// with the halo every gathered neighbour is already on the near side of the world. only when the positions are wrapped every
+	// step can a particle sit a world away from the cell it is stored in, then the border cells need wrapped distances
+	template<bool AtBorderX, bool AtBorderY>
+	neighbour_kernel_fn grid_kernel() const
+	{
+		return neighbour_kernels_.get<wrapped_every_step && AtBorderX, wrapped_every_step && AtBorderY>();
+	}
+
+
+	template<PositionFormat Format = position_format>
+	void append_cell_neighbours(const int halo_x, const int halo_y, NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		// one neighbour cell, in whichever form the kernels read. fixed-point coordinates wrap by themselves and are not shifted
+		const HaloLine& column = halo_columns_[halo_x + stencil_reach_];
+		const HaloLine& row = halo_rows_[halo_y + stencil_reach_];
+		const cell_idx cell_index = row.index * spatial_grid.cells_x + column.index;
+
+		if constexpr (storage_engine == StorageEngine::cell_resident)
+		{
+			resident_particles_.append_cell(cell_index, buffer.positions_x, buffer.positions_y, neighbours_size, column.shift, row.shift);
+		}
+		else if constexpr (Format == PositionFormat::fixed16)
+		{
+			add_fixed_cell(cell_index, buffer, neighbours_size);
+		}
+		else if (particles_sorted_)
+		{
+			// sorted particles are laid out in cell order, so the cell is one contiguous run
+			add_neighbour_run(spatial_grid.sorted_start[cell_index], spatial_grid.objects_count[cell_index], column.shift, row.shift, buffer, neighbours_size);
+		}
+		else
+		{
+			const obj_idx* contents = spatial_grid.cell_contents(cell_index);
+			const uint32_t size = spatial_grid.objects_count[cell_index];
+			for (uint32_t idx = 0; idx < size; ++idx)
+			{
+				buffer.positions_x[neighbours_size] = particles_.positions_x[contents[idx]] + column.shift;
+				buffer.positions_y[neighbours_size] = particles_.positions_y[contents[idx]] + row.shift;
+				++neighbours_size;
+			}
+		}
+	}
+
+
+	template<PositionFormat Format = position_format>
+	void add_neighbour_row_run(const int cell_index_x, const int halo_y, NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		// copies the cells cell_index_x - reach .. cell_index_x + reach of a row in one go. only valid for sorted particles
+		// and cells whose stencil stays within the grid on the x axis
+		const HaloLine& row = halo_rows_[halo_y + stencil_reach_];
+		const cell_idx first_cell = row.index * spatial_grid.cells_x + cell_index_x - stencil_reach_;
+		const uint32_t first = spatial_grid.sorted_start[first_cell];
+		const uint32_t size = spatial_grid.sorted_start[first_cell + 2 * stencil_reach_ + 1] - first;
+
+		if constexpr (Format == PositionFormat::fixed16)
+		{
+			add_fixed_neighbours(first, size, buffer, neighbours_size);
+		}
+		else
+		{
+			add_neighbour_run(first, size, 0.f, row.shift, buffer, neighbours_size);
+		}
+	}
+
+
+	void add_neighbour_run(const uint32_t first, const uint32_t size, const float shift_x, const float shift_y,
+		NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		// only the few runs from the halo are shifted, the rest are plain copies
+		add_shifted_run(particles_.positions_x.data() + first, size, shift_x, buffer.positions_x + neighbours_size);
+		add_shifted_run(particles_.positions_y.data() + first, size, shift_y, buffer.positions_y + neighbours_size);
+		neighbours_size += static_cast<int>(size);
+	}
+
+	static void add_shifted_run(const float* __restrict source, const uint32_t size, const float shift, float* __restrict destination)
+	{
+		if (shift == 0.f)
+		{
+			std::copy_n(source, size, destination);
+			return;
+		}
+
+		for (uint32_t idx = 0; idx < size; ++idx)
+		{
+			destination[idx] = source[idx] + shift;
+		}
+	}
+
+
+	struct FixedPointAccuracy
+	{
+		size_t particles = 0;
+		size_t total_differs = 0;
+		size_t right_differs = 0;
+		size_t steering_differs = 0;
+		int max_total_difference = 0;
+	};
+
+	template<bool AtBorderX, bool AtBorderY>
+	void compare_position_formats(const cell_idx cell_index, NeighbourBuffer& buffer, FixedPointAccuracy& accuracy)
+	{
+		const int float_size = gather_neighbours<AtBorderX, PositionFormat::float32>(cell_index, buffer);
+		const int fixed_size = gather_neighbours<AtBorderX, PositionFormat::fixed16>(cell_index, buffer);
+
+		const obj_idx* cell_contents = spatial_grid.cell_contents(cell_index);
+		for (uint32_t idx = 0; idx < spatial_grid.objects_count[cell_index]; ++idx)
+		{
+			const obj_idx index = cell_contents[idx];
+			const SinCos direction = trig_.evaluate<trig_mode>(particles_.headings[index]);
+
+			const NeighbourCounts reference = grid_kernel<AtBorderX, AtBorderY>()(buffer.positions_x, buffer.positions_y,
+				float_size, particles_.positions_x[index], particles_.positions_y[index], direction.sin, direction.cos, kernel_params_);
+			const NeighbourCounts fixed = count_fixed_neighbours(index, buffer.fixed_x, buffer.fixed_y, fixed_size);
+
+			// the particle turns right when at least half of its neighbours are on its right
+			const bool reference_turns = 2 * reference.on_right >= reference.total;
+			const bool fixed_turns = 2 * fixed.on_right >= fixed.total;
+
+			++accuracy.particles;
+			accuracy.total_differs += reference.total != fixed.total;
+			accuracy.right_differs += reference.on_right != fixed.on_right;
+			accuracy.steering_differs += reference_turns != fixed_turns;
+			accuracy.max_total_difference = std::max(accuracy.max_total_difference, std::abs(reference.total - fixed.total));
+		}
+	}
+
+
+	struct TrigModeReport
+	{
+		double max_error = 0.0;
+		double max_heading_error_degrees = 0.0;
+		double move_ns_per_particle = 0.0;
+		size_t particles = 0;
+		size_t right_differs = 0;
+		size_t steering_differs = 0;
+	};
+
+	static SinCos exact_sin_cos(const uint16_t heading)
+	{
+		const double angle = static_cast<double>(heading) * (6.283185307179586476925286766559 / 65536.0);
+		return { static_cast<float>(std::sin(angle)), static_cast<float>(std::cos(angle)) };
+	}
+
+	template<TrigMode Mode>
+	void measure_trig_mode(TrigModeReport& report)
+	{
+		for (uint32_t heading = 0; heading < 65536; ++heading)
+		{
+			const SinCos exact = exact_sin_cos(static_cast<uint16_t>(heading));
+			const SinCos approximate = trig_.evaluate<Mode>(static_cast<uint16_t>(heading));
+			const double heading_error = std::abs(std::remainder(std::atan2(approximate.sin, approximate.cos) - std::atan2(exact.sin, exact.cos), 6.283185307179586));
+
+			report.max_error = std::max({ report.max_error, std::abs(static_cast<double>(approximate.sin) - exact.sin),
+				std::abs(static_cast<double>(approximate.cos) - exact.cos) });
+			report.max_heading_error_degrees = std::max(report.max_heading_error_degrees, heading_error * (180.0 / 3.141592653589793));
+		}
+
+		// the move pass on one thread, run on copies of the positions so no particle actually moves
+		constexpr int repeats = 10;
+		ParticleStore::Column<float> moved_x = particles_.positions_x;
+		ParticleStore::Column<float> moved_y = particles_.positions_y;
+		const auto start = std::chrono::steady_clock::now();
+		for (int repeat = 0; repeat < repeats; ++repeat)
+		{
+			trig_.advance<Mode>(moved_x.data(), moved_y.data(), particles_.headings.data(), particles_.size(), gamma);
+		}
+		const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		report.move_ns_per_particle = elapsed.count() / (static_cast<double>(repeats) * particles_.size());
+	}
+
+	template<bool AtBorderX, bool AtBorderY>
+	void compare_trig_modes(const cell_idx cell_index, NeighbourBuffer& buffer, TrigModeReport (&reports)[3])
+	{
+		const int neighbours_size = gather_neighbours<AtBorderX, PositionFormat::float32>(cell_index, buffer);
+		const neighbour_kernel_fn count_neighbours = grid_kernel<AtBorderX, AtBorderY>();
+
+		const obj_idx* cell_contents = spatial_grid.cell_contents(cell_index);
+		for (uint32_t idx = 0; idx < spatial_grid.objects_count[cell_index]; ++idx)
+		{
+			const obj_idx index = cell_contents[idx];
+			const uint16_t heading = particles_.headings[index];
+			const SinCos directions[4] = { exact_sin_cos(heading), trig_.evaluate<TrigMode::table256>(heading),
+				trig_.evaluate<TrigMode::interpolated_table>(heading), trig_.evaluate<TrigMode::polynomial>(heading) };
+
+			NeighbourCounts counts[4];
+			for (int d = 0; d < 4; ++d)
+			{
+				counts[d] = count_neighbours(buffer.positions_x, buffer.positions_y, neighbours_size,
+					particles_.positions_x[index], particles_.positions_y[index], directions[d].sin, directions[d].cos, kernel_params_);
+			}
+
+			// the particle turns right when at least half of its neighbours are on its right
+			const bool reference_turns = 2 * counts[0].on_right >= counts[0].total;
+			for (int mode = 0; mode < 3; ++mode)
+			{
+				++reports[mode].particles;
+				reports[mode].right_differs += counts[mode + 1].on_right != counts[0].on_right;
+				reports[mode].steering_differs += (2 * counts[mode + 1].on_right >= counts[mode + 1].total) != reference_turns;
+			}
+		}
+	}
+
+
+	void add_fixed_cell(const cell_idx cell_index, NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		const uint32_t size = spatial_grid.objects_count[cell_index];
+
+		if (particles_sorted_)
+		{
+			add_fixed_neighbours(spatial_grid.sorted_start[cell_index], size, buffer, neighbours_size);
+			return;
+		}
+
+		const obj_idx* contents = spatial_grid.cell_contents(cell_index);
+		for (uint32_t idx = 0; idx < size; ++idx)
+		{
+			buffer.fixed_x[neighbours_size] = fixed_positions_x_[contents[idx]];
+			buffer.fixed_y[neighbours_size] = fixed_positions_y_[contents[idx]];
+			++neighbours_size;
+		}
+	}
+
+
+	void add_fixed_neighbours(const uint32_t first, const uint32_t size, NeighbourBuffer& buffer, int& neighbours_size)
+	{
+		std::copy_n(fixed_positions_x_.data() + first, size, buffer.fixed_x + neighbours_size);
+		std::copy_n(fixed_positions_y_.data() + first, size, buffer.fixed_y + neighbours_size);
+		neighbours_size += static_cast<int>(size);
+	}
+
+
+	NeighbourCounts count_fixed_neighbours(const obj_idx index, const int16_t* neighbours_x, const int16_t* neighbours_y, const int neighbours_size) const
+	{
+		const FixedSinCos direction = trig_.evaluate_fixed<trig_mode>(particles_.headings[index]);
+
+		return neighbour_kernels_.fixed(neighbours_x, neighbours_y, neighbours_size,
+			fixed_positions_x_[index], fixed_positions_y_[index], direction.sin, direction.cos, fixed_radius_sq_);
+	}
+
+
+	void quantise_positions()
+	{
+		// the fixed-point copy of the positions is refreshed once per step, before any neighbours are gathered
+		thread_pool.dispatch(static_cast<uint32_t>(particles_.size()), [this](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t i = start; i < end; ++i)
+			{
+				fixed_positions_x_[i] = to_fixed(particles_.positions_x[i]);
+				fixed_positions_y_[i] = to_fixed(particles_.positions_y[i]);
+			}
+		});
+	}
+
+	int16_t to_fixed(const float coordinate) const
+	{
+		// only the low 16 bits are kept, which is what makes the coordinates wrap
+		return static_cast<int16_t>(static_cast<int32_t>(std::nearbyint(coordinate * fixed_scale_)));
+	}
+
+
+	inline void update_particle(const obj_idx index, const neighbour_kernel_fn count_neighbours,
+		const float* neighbours_x, const float* neighbours_y,
+		const int neighbours_size)
+	{
+		update_heading(particles_.positions_x[index], particles_.positions_y[index], particles_.headings[index], particles_.neighbour_counts[index],
+			count_neighbours, neighbours_x, neighbours_y, neighbours_size);
+
+		if (fusing_step_)
+		{
+			move_to_next_position(index);
+		}
+	}
+
+
+	void move_to_next_position(const obj_idx index)
+	{
+		// the fused step: the particle moves along its new heading into the next buffer, and is wrapped straight away
+		const SinCos direction = trig_.evaluate<trig_mode>(particles_.headings[index]);
+		float x = particles_.positions_x[index] + gamma * direction.cos;
+		float y = particles_.positions_y[index] + gamma * direction.sin;
+
+		if constexpr (wrapped_every_step)
+		{
+			// a single step can only leave the world by a little, so one world size brings it back
+			x += (x < 0.f) * world_width_ - (x >= world_width_) * world_width_;
+			y += (y < 0.f) * world_height_ - (y >= world_height_) * world_height_;
+		}
+
+		next_positions_x_[index] = x;
+		next_positions_y_[index] = y;
+	}
+
+
+	inline void update_heading(const float x, const float y, uint16_t& heading, uint16_t& neighbourhood_count,
+		const neighbour_kernel_fn count_neighbours,
+		const float* neighbours_x, const float* neighbours_y,
+		const int neighbours_size)
+	{
+		const SinCos direction = trig_.evaluate<trig_mode>(heading);
+
+		// calculating the total and right particle count
+		const NeighbourCounts counts = count_neighbours(neighbours_x, neighbours_y, neighbours_size,
+			x, y, direction.sin, direction.cos, kernel_params_);
+
+		steer(heading, neighbourhood_count, counts);
+	}
+
+
+	void steer(uint16_t& heading, uint16_t& neighbourhood_count, const NeighbourCounts counts) const
+	{
+		const int total_neighbours = counts.total;
+		const int on_right_hemisphere = counts.on_right;
 
 		// checking if the direction is on the right of the particle, if so converting this into -1 for false and 1 for trie
 		const int left = total_neighbours - on_right_hemisphere;
-		const auto sign = static_cast<float>(((on_right_hemisphere - left) >= 0) * 2 - 1);
-		neighbourhood_count_[index] = on_right_hemisphere + left;
+		const int sign = ((on_right_hemisphere - left) >= 0) * 2 - 1;
+		neighbourhood_count = on_right_hemisphere + left;
 
-		angle += (UpdateRules::alpha + UpdateRules::beta * (on_right_hemisphere + left) * sign) * pi_div_180;
+		heading += static_cast<uint16_t>(turn_alpha_ + turn_beta_ * (on_right_hemisphere + left) * sign);
 	}
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../settings.h"
+#include "../utils/spatial_grid.h"
+
+/*
+	GridRenderer
+- draws the lines of a spatial grid and how many objects every cell holds
+- the grid itself has no graphics, so it can be stepped without a display. the lines are rebuilt whenever the grid was
+  resized since the last draw, e.g. by the grid tuner
+*/
+
+
+class GridRenderer
+{
+	sf::RenderWindow& window_;
+	const SpatialGrid& grid_;
+
+	sf::VertexBuffer vertexBuffer{};
+	sf::Font font;
+	sf::Text text;
+
+	// the resolution the vertex buffer was built for
+	uint32_t built_cells_x_ = 0;
+	uint32_t built_cells_y_ = 0;
+
+public:
+	GridRenderer(sf::RenderWindow& window, const SpatialGrid& grid) : window_(window), grid_(grid)
+	{
+		initFont();
+	}
+
+
+	void render()
+	{
+		if (built_cells_x_ != grid_.cells_x || built_cells_y_ != grid_.cells_y)
+		{
+			initVertexBuffer();
+		}
+
+		window_.draw(vertexBuffer);
+
+		// rendering the locations of each cell with their content counts
+		for (uint32_t x = 0; x < grid_.cells_x; ++x)
+		{
+			for (uint32_t y = 0; y < grid_.cells_y; ++y)
+			{
+				const cell_idx index = y * grid_.cells_x + x;
+				const sf::Vector2f topleft = { x * grid_.m_cellSize.x, y * grid_.m_cellSize.y };
+				text.setString("(" + std::to_string(x) + ", " + std::to_string(y) + ")  obj count: " + std::to_string(grid_.objects_count[index]));
+				text.setPosition(topleft);
+				window_.draw(text);
+			}
+		}
+	}
+
+private:
+	void initVertexBuffer()
+	{
+		built_cells_x_ = grid_.cells_x;
+		built_cells_y_ = grid_.cells_y;
+
+		std::vector<sf::Vertex> vertices(static_cast<std::vector<sf::Vertex>::size_type>((built_cells_x_ + built_cells_y_) * 2));
+
+		vertexBuffer = sf::VertexBuffer(sf::Lines, sf::VertexBuffer::Static);
+		vertexBuffer.create(vertices.size());
+
+		size_t counter = 0;
+		for (size_t x = 0; x < built_cells_x_; x++)
+		{
+			const float posX = static_cast<float>(x) * grid_.m_cellSize.x;
+			vertices[counter].position = { posX, 0 };
+			vertices[counter + 1].position = { posX, grid_.m_worldSize.y };
+			counter += 2;
+		}
+
+		for (size_t y = 0; y < built_cells_y_; y++)
+		{
+			const float posY = static_cast<float>(y) * grid_.m_cellSize.y;
+			vertices[counter].position = { 0, posY };
+			vertices[counter + 1].position = { grid_.m_worldSize.x, posY };
+			counter += 2;
+		}
+
+		for (size_t x = 0; x < counter; x++)
+		{
+			vertices[x].color = { 75, 75, 75 };
+		}
+
+		vertexBuffer.update(vertices.data(), vertices.size(), 0);
+	}
+
+	void initFont()
+	{
+		constexpr int char_size = 45;
+		if (!font.loadFromFile(FontSettings::font_path))
+		{
+			std::cerr << "[ERROR]: Failed to load font from: " << FontSettings::font_path << '\n';
+			return;
+		}
+		text = sf::Text("", font, char_size);
+	}
+};
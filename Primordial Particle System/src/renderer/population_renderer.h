@@ -0,0 +1,79 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include "grid_renderer.h"
+#include "../particle_system/PPS_renderer.h"
+#include "../particle_system/particle_system.h"
+#include "../settings.h"
+
+/*
+	PopulationRenderer
+- draws a ParticlePopulation into a window: the particles through PPS_Renderer, and on request the spatial grid and the beacons
+- the population is the headless simulation core and knows nothing of it. everything drawn is read from the population's
+  particle store and grid, which are brought up to date with sync_particle_store() once per frame
+*/
+
+
+class PopulationRenderer
+{
+	sf::RenderWindow& window_;
+	ParticlePopulation& population_;
+
+	PPS_Renderer pps_renderer_;
+	GridRenderer grid_renderer_;
+
+public:
+	PopulationRenderer(sf::RenderWindow& window, ParticlePopulation& population)
+		: window_(window), population_(population),
+		pps_renderer_(window, population.particles()), grid_renderer_(window, population.grid())
+	{
+		pps_renderer_.init();
+	}
+
+
+	void render(const bool draw_spatial_grid = false)
+	{
+		population_.sync_particle_store();
+
+		if (draw_spatial_grid)
+		{
+			grid_renderer_.render();
+		}
+
+		pps_renderer_.render();
+	}
+
+
+	// the circle a right click picks beacons in, around the mouse, and the beacons picked so far
+	void render_debug(const sf::Vector2f mouse_pos, const float debug_radius)
+	{
+		sf::CircleShape selection(debug_radius, 64);
+		selection.setOrigin(debug_radius, debug_radius);
+		selection.setPosition(mouse_pos);
+		selection.setFillColor(sf::Color::Transparent);
+		selection.setOutlineColor({ 255, 255, 255, 120 });
+		selection.setOutlineThickness(PPS_Settings::particle_radius);
+		window_.draw(selection);
+
+		render_beacons();
+	}
+
+private:
+	void render_beacons()
+	{
+		const float rad = PPS_Settings::particle_radius;
+		const ParticleStore& particles = population_.particles();
+
+		sf::CircleShape beacon_body;
+		beacon_body.setFillColor({ 255, 255, 255 });
+		beacon_body.setRadius(rad);
+
+		for (const size_t beacon_index : population_.beacons.particles())
+		{
+			const sf::Vector2f position = { particles.positions_x[beacon_index] - rad, particles.positions_y[beacon_index] - rad };
+			beacon_body.setPosition(position);
+			window_.draw(beacon_body);
+		}
+	}
+};
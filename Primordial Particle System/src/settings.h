@@ -1,7 +1,8 @@
 #pragma once
-#include <SFML/Graphics.hpp>
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <string>
 
 struct ColorSettings
@@ -32,13 +33,43 @@ struct SimulationSettings
 	inline static constexpr auto aspect_ratio = static_cast<float>(screen_width) / static_cast<float>(screen_height);
 	
 	inline static constexpr unsigned max_frame_rate = 5200;
-	inline static const sf::Color screen_color = { 0, 0, 0 };
+	inline static constexpr uint8_t screen_color[3] = { 0, 0, 0 };
 	inline static const std::string simulation_title = "Primordial Particle Simulation";
 
 	inline static constexpr bool record = false; // for recording timelapses
 	inline static constexpr bool Vsync = false;
 };
 
+// how the particle state is laid out in memory
+enum class StorageEngine
+{
+	index_grid,    // flat particle arrays, indexed through the spatial grid
+	cell_resident  // particles stored inside fixed-width blocks owned by each grid cell
+};
+
+// how the neighbour coordinates are handed to the distance tests
+enum class PositionFormat
+{
+	float32, // world coordinates as floats
+	fixed16  // 16-bit fixed point wrapping with the world, half the bytes and twice the lanes per distance test
+};
+
+// how the collision pass shares the cells between the threads
+enum class LoadBalancing
+{
+	static_slices, // an equal slice of cells per thread, as many cells but not as much work
+	stealing,      // equal slices claimed a row at a time, threads that run out steal from the busiest
+	cost_weighted  // slices of equal estimated cost from the cell populations of the last grid build, then stealing
+};
+
+// how the sin and cos of a heading are evaluated
+enum class TrigMode
+{
+	table256,           // 256 entry lookup table, headings are quantised to about 1.4 degrees
+	interpolated_table, // 1024 entry table with linear interpolation between the entries
+	polynomial          // minimax polynomials, no lookups so the heading loops vectorise
+};
+
 struct PPS_Settings
 {
 	/*
@@ -59,32 +90,164 @@ struct PPS_Settings
 	inline static constexpr size_t sub_iterations = 1;
 	
 	inline static constexpr unsigned threads = 16;
+
+	// the population and world scale the simulation starts with, unless others are given on the command line. see PopulationConfig
 	inline static constexpr unsigned particle_count = 100'000;
+	inline static constexpr float scale_factor = 120;
+
+	// every thread is pinned to its own cpu, spread over the numa nodes, and the particle arrays and grid are first touched by
+	// the threads that work on them so their memory is local. skipped when the process may use fewer cpus than `threads`
+	inline static constexpr bool pin_threads = false;
+
+	// the particle arrays and the grid are backed by 2 MB pages where the system allows it, which cuts tlb misses in the
+	// neighbour gathers once the population is in the millions. arrays smaller than 2 MB always use normal pages. linux only,
+	// see utils/huge_pages.h
+	inline static constexpr bool huge_pages = false;
+
+	// every run from the same seed ends in the same state whatever the thread count: the random generator is seeded with
+	// `seed`, the incremental grid update inserts in a fixed order, and the grid tuner is switched off as it decides by timing.
+	// the run keeps the grid the tuner starts from, cells just wider than the visual radius, whatever the PopulationConfig asks
+	inline static constexpr bool deterministic = false;
+	inline static constexpr unsigned seed = 1;
 
 	inline static constexpr int add_to_grid_freq = 5;
 
-	// scale factors determine how intense / large the difference is
-	inline static constexpr float scale_factor = 120;
-	inline static constexpr float param_scale_factor = 180.f;
+	// every grid_tuning_freq iterations the grid tuner tries cells of r, r/2 and r/3 for grid_tuning_steps steps each and
+	// keeps the fastest for the current density, and prints what it measured. 0 keeps the grid of the PopulationConfig for the
+	// whole run
+	inline static constexpr size_t grid_tuning_freq = 0;
+	inline static constexpr int grid_tuning_steps = 3;
+
+	// between the full rebuilds, the grid is kept exact every step by only moving the particles which changed cell
+	inline static constexpr bool incremental_grid = false;
+
+	// when the grid is rebuilt the particle arrays are permuted into cell order, so neighbouring particles are neighbours in memory
+	inline static constexpr bool reorder_by_cell = true;
 
-	// world width is the virtual space. screen width is the physical window size
-	inline static constexpr auto world_width  = SimulationSettings::screen_width * scale_factor;
-	inline static constexpr auto world_height = SimulationSettings::screen_height * scale_factor;
+	inline static constexpr StorageEngine storage_engine = StorageEngine::index_grid;
+	inline static constexpr size_t cell_block_width = 16; // particles per block of the cell-resident engine
 
-	// calculating how many spatial hash cells should be on each axis
-	inline static constexpr auto grid_cells_y = static_cast<size_t>(scale_factor);
-	inline static constexpr auto grid_cells_x = static_cast<size_t>((scale_factor) * SimulationSettings::aspect_ratio);
+	// the collision pass walks each row with a sliding window of 2 * reach + 1 gathered columns of cells, so moving one cell
+	// along only gathers the column entering the window instead of the whole stencil
+	inline static constexpr bool row_sweep = false;
+
+	inline static constexpr LoadBalancing load_balancing = LoadBalancing::static_slices;
+
+	inline static constexpr PositionFormat position_format = PositionFormat::float32;
+	inline static constexpr TrigMode trig_mode = TrigMode::table256;
+
+	// the collision pass also moves and wraps each particle as soon as its heading is updated, into double-buffered positions so
+	// the neighbours still see the old state. one pass over the particles per step instead of three
+	inline static constexpr bool fused_step = false;
+
+	// scale factors determine how intense / large the difference is
+	inline static constexpr float param_scale_factor = 180.f;
 
 	// Scale Sensitive Parameters
 	inline static constexpr float visual_radius = 5.f * param_scale_factor;
 	inline static constexpr float gamma = 0.67f * param_scale_factor;
 
+	// verlet neighbour lists: every particle lists everyone within visual_radius + verlet_skin, and the lists are reused until
+	// a neighbour could have been missed. replaces rebuilding the grid every add_to_grid_freq steps
+	inline static constexpr bool neighbour_lists = false;
+	inline static constexpr float verlet_skin = 4.f * gamma;
+
 
 	// graphical settings
 	inline static float particle_radius = 100.f;
 };
 
 
+// the size of a population and its world, chosen at runtime
+struct PopulationConfig
+{
+	size_t particle_count = PPS_Settings::particle_count;
+
+	// the world is the screen scaled up by world_scale. world width is the virtual space, screen width the physical window size
+	float world_scale = PPS_Settings::scale_factor;
+
+	// how many spatial hash cells are on each axis, 0 for cells just wider than the visual radius (a 3x3 stencil). the stencil
+	// reaches as many cells as the visual radius needs, see ParticlePopulation::stencil_reach_for
+	uint32_t grid_cells_x = 0;
+	uint32_t grid_cells_y = 0;
+
+	float world_width() const
+	{
+		return static_cast<float>(SimulationSettings::screen_width) * world_scale;
+	}
+
+	float world_height() const
+	{
+		return static_cast<float>(SimulationSettings::screen_height) * world_scale;
+	}
+
+	uint32_t cells_x() const
+	{
+		return grid_cells_x > 0 ? grid_cells_x : std::max(1u, static_cast<uint32_t>(world_width() / PPS_Settings::visual_radius));
+	}
+
+	uint32_t cells_y() const
+	{
+		return grid_cells_y > 0 ? grid_cells_y : std::max(1u, static_cast<uint32_t>(world_height() / PPS_Settings::visual_radius));
+	}
+
+	// the rows of the table in PPS_Settings, the world scale keeping each population at a density that forms cells
+	struct Preset
+	{
+		size_t particle_count;
+		float world_scale;
+	};
+	inline static constexpr std::array<Preset, 10> presets = { {
+		{ 1'000, 15.f }, { 5'000, 30.f }, { 10'000, 50.f }, { 20'000, 70.f }, { 50'000, 105.f },
+		{ 100'000, 160.f }, { 200'000, 250.f }, { 500'000, 400.f }, { 1'000'000, 550.f }, { 4'000'000, 650.f }
+	} };
+
+	// a population of `count` in a world scaled like the table, interpolated between its rows
+	static PopulationConfig for_particle_count(const size_t count)
+	{
+		PopulationConfig config;
+		config.particle_count = count;
+		config.world_scale = presets.front().world_scale;
+		for (size_t row = 0; row < presets.size(); ++row)
+		{
+			if (count >= presets[row].particle_count)
+			{
+				config.world_scale = presets[row].world_scale;
+				if (row + 1 < presets.size() && count < presets[row + 1].particle_count)
+				{
+					const Preset& low = presets[row];
+					const Preset& high = presets[row + 1];
+					const float t = static_cast<float>(count - low.particle_count) / static_cast<float>(high.particle_count - low.particle_count);
+					config.world_scale = low.world_scale + t * (high.world_scale - low.world_scale);
+				}
+			}
+		}
+		return config;
+	}
+
+	// "pps [particle count] [world scale] [grid cells x] [grid cells y]", anything not given keeps the settings, a particle
+	// count alone takes the world scale from the table
+	static PopulationConfig from_arguments(const int argc, char** argv)
+	{
+		PopulationConfig config;
+		if (argc > 1)
+		{
+			config = for_particle_count(std::stoull(argv[1]));
+		}
+		if (argc > 2)
+		{
+			config.world_scale = std::stof(argv[2]);
+		}
+		if (argc > 4)
+		{
+			config.grid_cells_x = static_cast<uint32_t>(std::stoul(argv[3]));
+			config.grid_cells_y = static_cast<uint32_t>(std::stoul(argv[4]));
+		}
+		return config;
+	}
+};
+
+
 struct Setting
 {
 	float alpha;
@@ -1,6 +1,7 @@
 #pragma once
 #include "settings.h"
 #include "particle_system/particle_system.h"
+#include "renderer/population_renderer.h"
 #include "utils/smooth_frame_rates.h"
 #include "utils/font.h"
 #include "utils/Camera.hpp"
@@ -19,6 +20,9 @@ inline float interpolateZoom(float currentZoom, float targetZoom, float deltaTim
 
 class Simulation : PPS_Settings, SimulationSettings
 {
+	// the population and world size, chosen at start-up
+	const PopulationConfig config_;
+
 	// SFML
 	sf::RenderWindow window_{};
 
@@ -26,7 +30,7 @@ class Simulation : PPS_Settings, SimulationSettings
 	FrameRateSmoothing<10> clock_{};
 
 	// Allows for translation & Zooming
-	Camera camera_{ &window_, 1.f / scale_factor };
+	Camera camera_{ &window_, 1.f / config_.world_scale };
 
 
 	// Two separate font sizes. allows rendering of text on-screen
@@ -34,8 +38,6 @@ class Simulation : PPS_Settings, SimulationSettings
 	Font text_font_ = { &window_, 35, FontSettings::font_path };
 
 	// Runtime variables and statistics
-	size_t iterations_ = 0;
-
 	bool paused_ = true;
 	bool running_ = true;
 	bool render_hash_grid_ = false;
@@ -49,16 +51,20 @@ class Simulation : PPS_Settings, SimulationSettings
 	// radius around the mouse in which debug settings are shown
 	float debug_radius_ = 8000.f;
 	const float change_in_debug_radius_ = 500.f;
-	SFML_Grid render_grid_{ window_, sf::FloatRect(0, 0, world_width, world_height), 10 };
+	SFML_Grid render_grid_{ window_, sf::FloatRect(0, 0, config_.world_width(), config_.world_height()), 10 };
+
+	// The particle system, and what draws it
+	ParticlePopulation particle_system_{ config_ };
+	PopulationRenderer population_renderer_{ window_, particle_system_ };
 
-	// The particle system
-	ParticlePopulation<particle_count> particle_system_{ window_ };
+	// how much of the population the + and - keys add or remove
+	const float population_change_ = 0.1f;
 
 	sf::Clock delta_clock_{}; // for ImGui
 
 
 public:
-	Simulation() : window_(
+	explicit Simulation(const PopulationConfig& config = {}) : config_(config), window_(
 		sf::VideoMode(screen_width, screen_height),
 		simulation_title,
 		sf::Style::Default,
@@ -74,7 +80,7 @@ public:
 		window_.setVerticalSyncEnabled(Vsync);
 
 		// setting the camera_ pos to the center by default
-		camera_.set_camera_position({ world_width / 2, world_height / 2 });
+		camera_.set_camera_position({ config_.world_width() / 2, config_.world_height() / 2 });
 		camera_.update(0.f);
 	}
 
@@ -112,21 +118,14 @@ private:
 		// sub-iterations are used to have more updates between rendering, can be used to speed up the simulation or make a smoother simulation
 		for (size_t i = 0; i < sub_iterations; ++i)
 		{
-			// particles don't move very much and take many time steps to cross grid spaces, so updating their grid location happens every nth frame
-			if (iterations_ % add_to_grid_freq == 0)
-			{
-				particle_system_.add_particles_to_grid();
-			}
-
-			particle_system_.update_particles(paused_);
+			particle_system_.step(paused_);
 		}
-		iterations_ += sub_iterations; // accounting for sub-iterations
 	}
 
 	void render()
 	{
 		// even with rendering 'off' the sfml window still needs to be cleared and displayed for ImGUI
-		window_.clear(screen_color);
+		window_.clear({ screen_color[0], screen_color[1], screen_color[2] });
 
 		if (rendering_)
 		{
@@ -141,12 +140,11 @@ private:
 	{
 		const sf::Vector2f mouse_pos = camera_.get_world_mouse_pos();
 
-		particle_system_.render(window_, render_hash_grid_, mouse_pos);
+		population_renderer_.render(render_hash_grid_);
 
 		if (debug_)
 		{
-			particle_system_.render_debug(window_, mouse_pos, debug_radius_);
-			particle_system_.beacons.render(window_); // todo
+			population_renderer_.render_debug(mouse_pos, debug_radius_);
 		}
 
 		//render_grid_.draw(); todo 
@@ -215,11 +213,48 @@ private:
 		case sf::Keyboard::D:
 			debug_ = !debug_;
 			break;
+
+		case sf::Keyboard::F:
+			particle_system_.report_fixed_point_accuracy();
+			break;
+
+		case sf::Keyboard::T:
+			particle_system_.report_trig_modes();
+			break;
+
+		case sf::Keyboard::P:
+			particle_system_.report_thread_placement();
+			break;
+
+		case sf::Keyboard::L:
+			particle_system_.report_load_balance();
+			break;
+
+		case sf::Keyboard::Add:
+		case sf::Keyboard::Equal:
+			particle_system_.add_particles(population_change());
+			break;
+
+		case sf::Keyboard::Subtract:
+		case sf::Keyboard::Hyphen:
+			particle_system_.remove_particles(population_change());
+			break;
+
+		case sf::Keyboard::H:
+			std::cout << "[INFO]: state hash after " << particle_system_.iterations() << " iterations: " << std::hex
+				<< particle_system_.state_hash() << std::dec << '\n';
+			break;
 		default: ;
 		}
 	}
 
 
+	size_t population_change() const
+	{
+		return std::max<size_t>(1, static_cast<size_t>(static_cast<float>(particle_system_.particle_count()) * population_change_));
+	}
+
+
 	void poll_events()
 	{
 		float deltaTime = clock_.get_delta_time();
@@ -267,7 +302,8 @@ private:
 
 		else if (sf::Mouse::isButtonPressed(sf::Mouse::Right))
 		{
-			particle_system_.beacons.add_beacons(camera_.get_world_mouse_pos(), debug_radius_);
+			const sf::Vector2f mouse_pos = camera_.get_world_mouse_pos();
+			particle_system_.beacons.add_beacons(mouse_pos.x, mouse_pos.y, debug_radius_);
 		}
 	}
 
@@ -283,7 +319,7 @@ private:
 
 		title_font_.draw(start, simulation_title);
 		text_font_.draw(start + sf::Vector2f{0.f, spacing * i++}, std::to_string(fps) + " fps");
-		text_font_.draw(start + sf::Vector2f{0.f, spacing * i++}, "particles");
+		text_font_.draw(start + sf::Vector2f{0.f, spacing * i++}, std::to_string(particle_system_.particle_count()) + " particles");
 		text_font_.draw(start + sf::Vector2f{0.f, spacing * i}, "iterations");
 
 
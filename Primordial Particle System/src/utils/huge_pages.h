@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#endif
+
+#include "../settings.h"
+
+/*
+	HugePages
+- with PPS_Settings::huge_pages set, arrays of a huge page (2 MB) or more are mapped straight from the os and asked to be
+  backed by huge pages, smaller ones come from the heap. one tlb entry then covers 512 times as much memory, which matters
+  for the random gathers from millions of particles
+- linux only, through mmap and madvise(MADV_HUGEPAGE). transparent huge pages must be set to "always" or "madvise".
+  elsewhere the arrays come from the heap aligned to 2 MB, windows' large pages need the "lock pages in memory" privilege
+  granted to the user and enabled in the process, which is not done here
+- when the system does not hand them out the arrays are simply backed by normal pages, see backed_bytes() for what was obtained
+- the pages still land on the numa node of the thread that first touches them, but a whole huge page at a time
+*/
+
+
+struct HugePages
+{
+	inline static constexpr size_t page_size = size_t{ 2 } << 20;
+
+
+	static void* map(const size_t bytes)
+	{
+		const size_t length = round_up(bytes);
+#if defined(__linux__)
+		// one huge page more is mapped and the ends trimmed off, so the array starts on a huge page boundary
+		void* mapping = mmap(nullptr, length + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			throw std::bad_alloc();
+		}
+
+		const auto mapping_start = reinterpret_cast<uintptr_t>(mapping);
+		const uintptr_t start = (mapping_start + page_size - 1) & ~(page_size - 1);
+		const uintptr_t end = start + length;
+		if (start > mapping_start)
+		{
+			munmap(mapping, start - mapping_start);
+		}
+		if (mapping_start + length + page_size > end)
+		{
+			munmap(reinterpret_cast<void*>(end), mapping_start + length + page_size - end);
+		}
+
+#ifdef MADV_HUGEPAGE
+		madvise(reinterpret_cast<void*>(start), length, MADV_HUGEPAGE);
+#endif
+		return reinterpret_cast<void*>(start);
+#else
+		return ::operator new(length, std::align_val_t{ page_size });
+#endif
+	}
+
+	static void unmap(void* data, const size_t bytes)
+	{
+#if defined(__linux__)
+		munmap(data, round_up(bytes));
+#else
+		(void)bytes;
+		::operator delete(data, std::align_val_t{ page_size });
+#endif
+	}
+
+
+	// - how much of an array is currently backed by huge pages. pages never touched are not backed by anything yet.
+	// - on linux from the AnonHugePages of every mapping in /proc/self/smaps overlapping the array, a mapping merged with
+	//   a neighbouring one may be counted for the part of it outside the array too
+	static size_t backed_bytes(const void* data, const size_t bytes)
+	{
+		if (data == nullptr || bytes == 0)
+		{
+			return 0;
+		}
+#if defined(__linux__)
+		const auto begin = reinterpret_cast<uintptr_t>(data);
+		const uintptr_t end = begin + bytes;
+
+		std::ifstream smaps("/proc/self/smaps");
+		std::string line;
+		size_t overlap = 0;
+		size_t backed = 0;
+		while (std::getline(smaps, line))
+		{
+			// every mapping starts with a line "start-end perms ...", followed by lines "Field: value kB"
+			if (line.rfind("AnonHugePages:", 0) == 0)
+			{
+				size_t kilobytes = 0;
+				std::istringstream(line.substr(14)) >> kilobytes;
+				backed += std::min(kilobytes * 1024, overlap);
+				continue;
+			}
+
+			uintptr_t mapping_start = 0;
+			uintptr_t mapping_end = 0;
+			char dash = 0;
+			std::istringstream header(line);
+			if (header >> std::hex >> mapping_start >> dash >> mapping_end && dash == '-' && line.find(':') > line.find(' '))
+			{
+				overlap = mapping_end > begin && mapping_start < end ? std::min(end, mapping_end) - std::max(begin, mapping_start) : 0;
+			}
+		}
+		return std::min(backed, bytes);
+#else
+		(void)data;
+		return 0;
+#endif
+	}
+
+
+private:
+	static size_t round_up(const size_t bytes)
+	{
+		return (bytes + page_size - 1) & ~(page_size - 1);
+	}
+};
+
+
+// how much memory a set of arrays takes, and how much of it is backed by huge pages
+struct PageBacking
+{
+	size_t bytes = 0;
+	size_t huge_bytes = 0;
+
+	template<typename T, typename Allocator>
+	void add(const std::vector<T, Allocator>& array)
+	{
+		bytes += array.capacity() * sizeof(T);
+		huge_bytes += HugePages::backed_bytes(array.data(), array.capacity() * sizeof(T));
+	}
+};
+
+
+// hands out memory aligned to a cache line, for std::vector. with PPS_Settings::huge_pages, arrays of a huge page or more
+// are backed by huge pages
+template<typename T>
+struct AlignedAllocator
+{
+	using value_type = T;
+	inline static constexpr size_t alignment = 64;
+
+	AlignedAllocator() = default;
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(const size_t count)
+	{
+		const size_t bytes = count * sizeof(T);
+		if (PPS_Settings::huge_pages && bytes >= HugePages::page_size)
+		{
+			return static_cast<T*>(HugePages::map(bytes));
+		}
+		return static_cast<T*>(::operator new(bytes, std::align_val_t{ alignment }));
+	}
+
+	void deallocate(T* data, const size_t count)
+	{
+		const size_t bytes = count * sizeof(T);
+		if (PPS_Settings::huge_pages && bytes >= HugePages::page_size)
+		{
+			HugePages::unmap(data, bytes);
+			return;
+		}
+		::operator delete(data, std::align_val_t{ alignment });
+	}
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U>&) const
+	{
+		return true;
+	}
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <random>
-#include <SFML/Graphics.hpp>
+#include <type_traits>
 
 namespace Random
 {
@@ -35,45 +35,6 @@ namespace Random
         }
     }
 
-    // random SFML::Vector<Type>
-    inline sf::Color rand_color(const sf::Vector3<int> rgb_min = { 0, 0, 0 },
-        const sf::Vector3<int> rgb_max = { 255, 255, 255 })
-    {
-        return {
-            static_cast<sf::Uint8>(rand_range(rgb_min.x, rgb_max.x)), // red value
-            static_cast<sf::Uint8>(rand_range(rgb_min.y, rgb_max.y)), // green value
-            static_cast<sf::Uint8>(rand_range(rgb_min.z, rgb_max.z))  // blue value
-        };
-    }
-
-    template<typename Type>
-    inline sf::Vector2<Type> rand_vector(const Type min, const Type max)
-    {
-        return { rand_range(min, max), rand_range(min, max) };
-    }
-
-    template<typename Type>
-    inline sf::Vector2<Type> rand_pos_in_rect(const sf::Rect<Type>& rect)
-    {
-        return { rand_range(rect.left, rect.left + rect.width),
-                rand_range(rect.top, rect.top + rect.height) };
-    }
-
-    template<typename Type>
-    sf::Vector2<Type> rand_pos_in_circle(const sf::Vector2<Type> center, const float radius)
-    {
-        const sf::Rect<Type> rect = { center.x - radius, center.y - radius, radius * 2, radius * 2 };
-        while (true)
-        {
-            const sf::Vector2<Type> pos = rand_pos_in_rect(rect);
-            const sf::Vector2<Type> delta = pos - center;
-            const float dist_sq = delta.x * delta.x + delta.y * delta.y;
-
-            if (dist_sq <= radius * radius)
-                return pos;
-        }
-    }
-
     inline void set_seed(const unsigned int seed = std::random_device{}())
     {
         rng.seed(seed);
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/*
+	ScratchArena
+- temporary memory for one worker: a bump allocator handing out pieces of 64-byte aligned blocks
+- every piece starts on its own cache line, and the arena object is itself aligned and padded to whole cache lines, so the
+  arenas of two workers never share a line
+- pieces are freed all at once: rewind() to a mark() frees everything handed out after it, reserve() frees everything
+- reserve() is called between steps with the most a step can need, then a step never touches the heap
+- should a step need more anyway, another block is chained on rather than moving the pieces already handed out. the next
+  reserve() merges the blocks into a single one large enough for both, so there is no upper limit on what a step may ask for
+*/
+
+
+class alignas(64) ScratchArena
+{
+public:
+	inline static constexpr size_t alignment = 64;
+
+	ScratchArena() = default;
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	~ScratchArena()
+	{
+		free_blocks();
+	}
+
+
+	// a position in the arena to rewind to
+	struct Mark
+	{
+		size_t block;
+		size_t offset;
+	};
+
+
+	// making room for at least `bytes` in one block, dropping every piece handed out. merges the blocks a step had to chain on
+	void reserve(const size_t bytes)
+	{
+		const size_t required = std::max(round_up(bytes), blocks_.size() > 1 ? total_capacity() : size_t{ 0 });
+		if (blocks_.size() != 1 || blocks_[0].capacity < required)
+		{
+			free_blocks();
+			add_block(required);
+		}
+		current_ = 0;
+		offset_ = 0;
+	}
+
+	// `count` uninitialised elements, aligned to a cache line
+	template<typename T>
+	T* allocate(const size_t count)
+	{
+		static_assert(alignof(T) <= alignment);
+		const size_t bytes = round_up(count * sizeof(T));
+
+		// moving on to the next block, or chaining a new one, when the current one is full
+		while (blocks_.empty() || offset_ + bytes > blocks_[current_].capacity)
+		{
+			if (!blocks_.empty() && current_ + 1 < blocks_.size())
+			{
+				++current_;
+				offset_ = 0;
+				continue;
+			}
+
+			add_block(std::max(bytes, total_capacity()));
+			current_ = blocks_.size() - 1;
+			offset_ = 0;
+			++overflow_count;
+		}
+
+		T* piece = reinterpret_cast<T*>(blocks_[current_].data + offset_);
+		offset_ += bytes;
+		return piece;
+	}
+
+	Mark mark() const
+	{
+		return { current_, offset_ };
+	}
+
+	void rewind(const Mark mark)
+	{
+		current_ = mark.block;
+		offset_ = mark.offset;
+	}
+
+	size_t total_capacity() const
+	{
+		size_t total = 0;
+		for (const Block& block : blocks_)
+		{
+			total += block.capacity;
+		}
+		return total;
+	}
+
+	// how many times a step has needed more than was reserved, each one cost a heap allocation
+	uint32_t overflow_count = 0;
+
+
+private:
+	struct Block
+	{
+		std::byte* data;
+		size_t capacity;
+	};
+
+	static size_t round_up(const size_t bytes)
+	{
+		return (bytes + alignment - 1) & ~(alignment - 1);
+	}
+
+	void add_block(const size_t bytes)
+	{
+		const size_t capacity = std::max(round_up(bytes), alignment);
+		blocks_.push_back({ static_cast<std::byte*>(::operator new(capacity, std::align_val_t{ alignment })), capacity });
+	}
+
+	void free_blocks()
+	{
+		for (const Block& block : blocks_)
+		{
+			::operator delete(block.data, std::align_val_t{ alignment });
+		}
+		blocks_.clear();
+	}
+
+	std::vector<Block> blocks_{};
+	size_t current_ = 0; // the block pieces are handed out from
+	size_t offset_ = 0;  // how far into it
+};
@@ -1,166 +1,548 @@
 #pragma once
 
-#include <SFML/Graphics.hpp>
-
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <iostream>
-#include <array>
+#include <vector>
+
+#include "huge_pages.h"
+#include "thread_pool.h"
 
 /*
 	SpatialGrid
-- have no more than 65,536 (2^16) objects
-- if experiencing error make sure your objects don't go out of bounds
+- stored in compressed-sparse-row form: the objects of every cell sit next to each other in one flat array
+- a rebuild counts the objects per cell, takes an exclusive prefix sum to find where each cell starts, then scatters the indices
+- there is no per-cell capacity, and the memory used is proportional to the object count
+- the build runs on the thread pool: every thread owns a contiguous block of cells, the objects are first handed to the
+  thread owning their cell, which then counts and scatters them. no cell is ever written by two threads, the memory used
+  does not grow with the thread count, and objects keep ascending index order inside each cell regardless of the thread count
+- on a single thread the build is a plain counting sort instead, the handing over would only copy every index once more
+- with reserve_slack set every cell gets some spare slots, so update() can move only the objects which changed cell
+  instead of rebuilding. when a cell runs out of room the slots are re-laid out from the current counts, without rehashing
+- update() fills the cells in whatever order the threads get to them, unless stable_order is set
+- the number of cells is chosen at runtime and can be changed with resize(), the next build fills the new cells
+- objects hashing outside the grid are left out of a build and reported through inserted_count, make sure your objects don't go out of bounds
+- has no graphics of its own, see renderer/grid_renderer.h for drawing it
 */
 
 // make cell render_grid_ 2d
-// tell objects what index they are in
-// instead of removing and re-adding every frame. only remove and re-add if a object changes its cell
 
 
 using cell_idx = uint32_t;
 using obj_idx = uint32_t;
 
-// maximum number of objects a cell can hold
-static constexpr uint8_t cell_capacity = 25;
 
+// a size along both axes
+struct GridExtent
+{
+	float x = 0.f;
+	float y = 0.f;
+};
 
 
-template<size_t CellsX, size_t CellsY>
 class SpatialGrid
 {
 public:
-	explicit SpatialGrid(const sf::FloatRect screen_size = {}) : m_screenSize(screen_size)
+	explicit SpatialGrid(const float world_width = 0.f, const float world_height = 0.f, const uint32_t cells_x = 1, const uint32_t cells_y = 1)
 	{
-		objects_count.resize(total_cells, 0);
-		grid.resize(total_cells, std::array<cell_idx, cell_capacity>());
-
-		init_graphics();
-		initVertexBuffer();
-		initFont();
+		// increasing the size of the boundaries very slightly stops any out-of-range errors
+		constexpr float margin = 1.f;
+		m_worldSize = { world_width + margin, world_height + margin };
+		resize(cells_x, cells_y);
 	}
 	~SpatialGrid() = default;
 
 
+	// changing the number of cells on each axis. the contents are dropped, the grid has to be built again before it is used
+	void resize(const uint32_t new_cells_x, const uint32_t new_cells_y)
+	{
+		cells_x = new_cells_x;
+		cells_y = new_cells_y;
+		total_cells = static_cast<size_t>(cells_x) * cells_y;
+
+		m_cellSize = { m_worldSize.x / static_cast<float>(cells_x),
+						  m_worldSize.y / static_cast<float>(cells_y) };
+
+		objects_count.assign(total_cells, 0);
+		cell_start.assign(total_cells + 1, 0);
+		objects.clear();
+		sorted_start.clear();
+		max_cell_size = 0;
+	}
+
+
+	// sizing the per-object and per-cell arrays for `object_count` objects, with their pages placed next to the threads that
+	// build from them (see tp::firstTouch). a build needing more room than that, with reserve_slack, still grows on the calling thread
+	bool first_touch(const size_t object_count, tp::ThreadPool& thread_pool)
+	{
+		cell_of.resize(object_count);
+		objects.resize(object_count);
+		staged_.resize(object_count);
+
+		bool placed = tp::firstTouch(cell_of, thread_pool);
+		placed &= tp::firstTouch(objects, thread_pool);
+		placed &= tp::firstTouch(staged_, thread_pool);
+		placed &= tp::firstTouch(objects_count, thread_pool);
+		placed &= tp::firstTouch(cell_start, thread_pool);
+		return placed;
+	}
+
+
+	// how much memory the per-object and per-cell arrays take, and how much of it is backed by huge pages
+	void page_backing(PageBacking& backing) const
+	{
+		backing.add(objects);
+		backing.add(cell_start);
+		backing.add(objects_count);
+		backing.add(cell_of);
+		backing.add(staged_);
+	}
+
+
 	cell_idx inline hash(const float x, const float y) const
 	{
 		const auto cell_x = static_cast<cell_idx>(x / m_cellSize.x);
 		const auto cell_y = static_cast<cell_idx>(y / m_cellSize.y);
-		return cell_y * CellsX + cell_x;
+		return cell_y * cells_x + cell_x;
 	}
 
 
-	// adding an object to the spatial hash render_grid_ by a position and storing its obj_id
-	cell_idx inline add_object(const float x, const float y, const size_t obj_id)
+	// rebuilding the grid from the positions of every object, object i is stored by its index
+	void build(const float* positions_x, const float* positions_y, const size_t object_count, tp::ThreadPool& thread_pool)
 	{
-		const cell_idx index = hash(x, y);
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const size_t objects_per_thread = object_count / thread_count;
+		const size_t cells_per_thread = total_cells / thread_count;
+
+		cell_of.resize(object_count);
+		staged_.resize(object_count);
+		cell_cursor_.resize(total_cells);
+		block_counts_.resize(static_cast<size_t>(thread_count) * thread_count);
+		block_totals_.resize(thread_count);
+		block_max_sizes_.resize(thread_count);
+		inserted_count = 0;
+
+		if (thread_count == 1)
+		{
+			build_serial(positions_x, positions_y, object_count);
+			return;
+		}
 
-		// adding the atom and incrementing the size
-		uint8_t& count = objects_count[index];
+		const auto object_range = [object_count, objects_per_thread, thread_count](const uint32_t t)
+		{
+			const size_t start = t * objects_per_thread;
+			const size_t end = (t == thread_count - 1) ? object_count : start + objects_per_thread;
+			return std::pair{ start, end };
+		};
 
-		grid[index][count] = static_cast<obj_idx>(obj_id);
-		count += count < cell_capacity - 1; // subtracting one prevents going over the size
+		const auto cell_range = [this, thread_count, cells_per_thread](const uint32_t t)
+		{
+			const size_t start = t * cells_per_thread;
+			const size_t end = (t == thread_count - 1) ? total_cells : start + cells_per_thread;
+			return std::pair{ start, end };
+		};
 
-		return index;
-	}
+		// the thread owning a cell, the cells are split into one contiguous block per thread
+		const auto block_of = [thread_count, cells_per_thread](const cell_idx index)
+		{
+			return cells_per_thread ? static_cast<uint32_t>(std::min<size_t>(index / cells_per_thread, thread_count - 1)) : thread_count - 1;
+		};
 
-	inline void clear()
-	{
-		for (int idx = 0; idx < total_cells; ++idx)
+		// counting pass, each thread hashes its own objects, remembers their cell so nothing is hashed again, and counts how
+		// many of them fall into every thread's block of cells. an object hashing outside the grid is left out
+		thread_pool.parallel([this, thread_count, positions_x, positions_y, &object_range, &block_of](const uint32_t t) {
+			uint32_t* counts = block_counts_.data() + static_cast<size_t>(t) * thread_count;
+			std::fill(counts, counts + thread_count, 0);
+
+			const auto [start, end] = object_range(t);
+			for (size_t i = start; i < end; ++i)
+			{
+				const cell_idx index = hash(positions_x[i], positions_y[i]);
+				cell_of[i] = index;
+				if (index < total_cells)
+				{
+					++counts[block_of(index)];
+				}
+			}
+			});
+
+		// the staged objects are grouped by block, and inside a block by the thread which found them
+		uint32_t staged_total = 0;
+		for (uint32_t block = 0; block < thread_count; ++block)
 		{
-			objects_count[idx] = 0;
+			for (uint32_t t = 0; t < thread_count; ++t)
+			{
+				uint32_t& count = block_counts_[static_cast<size_t>(t) * thread_count + block];
+				const uint32_t thread_count_in_block = count;
+				count = staged_total;
+				staged_total += thread_count_in_block;
+			}
 		}
-	}
 
+		// staging pass, every thread hands its objects to the thread owning their cell. each thread writes its own ranges,
+		// and the objects of a block stay in ascending index order
+		thread_pool.parallel([this, thread_count, &object_range, &block_of](const uint32_t t) {
+			uint32_t* slots = block_counts_.data() + static_cast<size_t>(t) * thread_count;
 
-	void render_grid(sf::RenderWindow& window)
-	{
-		window.draw(vertexBuffer);
+			const auto [start, end] = object_range(t);
+			for (size_t i = start; i < end; ++i)
+			{
+				if (cell_of[i] < total_cells)
+				{
+					staged_[slots[block_of(cell_of[i])]++] = static_cast<obj_idx>(i);
+				}
+			}
+			});
 
-		// rendering the locations of each cell with their content counts
-		for (int x = 0; x < CellsX; ++x)
+		// where the staged objects of a block start and end, after the staging pass every slot has moved to the next block's start
+		const auto staged_range = [this, thread_count](const uint32_t block)
 		{
-			for (int y = 0; y < CellsY; ++y)
+			const uint32_t end = block_counts_[static_cast<size_t>(thread_count - 1) * thread_count + block];
+			const uint32_t start = block == 0 ? 0 : block_counts_[static_cast<size_t>(thread_count - 1) * thread_count + block - 1];
+			return std::pair{ start, end };
+		};
+
+		// every thread counts the objects of its own cells, so no cell is written by two threads. then the total of every block
+		thread_pool.parallel([this, &cell_range, &staged_range](const uint32_t t) {
+			const auto [cells_start, cells_end] = cell_range(t);
+			std::fill(objects_count.data() + cells_start, objects_count.data() + cells_end, 0);
+
+			const auto [start, end] = staged_range(t);
+			for (uint32_t slot = start; slot < end; ++slot)
+			{
+				++objects_count[cell_of[staged_[slot]]];
+			}
+
+			uint32_t total = 0;
+			for (size_t idx = cells_start; idx < cells_end; ++idx)
 			{
-				const cell_idx index = y * CellsX + x;
-				const sf::Vector2f topleft = { x * m_cellSize.x, y * m_cellSize.y };
-				text.setString("(" + std::to_string(x) + ", " + std::to_string(y) + ")  obj count: " + std::to_string(objects_count[index]));
-				text.setPosition(topleft);
-				window.draw(text);
+				total += cell_capacity(objects_count[idx]);
 			}
+			block_totals_[t] = total;
+			});
+
+		uint32_t running_total = 0;
+		for (uint32_t t = 0; t < thread_count; ++t)
+		{
+			const uint32_t block_total = block_totals_[t];
+			block_totals_[t] = running_total;
+			running_total += block_total;
 		}
+		cell_start[total_cells] = running_total;
+		objects.resize(running_total);
+		cell_dirty_.assign(total_cells, 0);
+
+		// then every block scans its own cells and scatters its staged objects into them. the objects counted into the cells
+		// are what the build inserted, an object left out or a slot counted twice makes it differ from the object count
+		thread_pool.parallel([this, &cell_range, &staged_range](const uint32_t t) {
+			const auto [cells_start, cells_end] = cell_range(t);
+			uint32_t running = block_totals_[t];
+			uint32_t max_size = 0;
+			uint32_t inserted = 0;
+			for (size_t idx = cells_start; idx < cells_end; ++idx)
+			{
+				const uint32_t capacity = cell_capacity(objects_count[idx]);
+				cell_start[idx] = running;
+				cell_cursor_[idx] = running;
+				running += capacity;
+				max_size = std::max(max_size, capacity);
+				inserted += objects_count[idx];
+			}
+			block_max_sizes_[t] = max_size;
+
+			const auto [start, end] = staged_range(t);
+			for (uint32_t slot = start; slot < end; ++slot)
+			{
+				const obj_idx object = staged_[slot];
+				objects[cell_cursor_[cell_of[object]]++] = object;
+			}
+			inserted_count += inserted;
+			});
+
+		max_cell_size = *std::max_element(block_max_sizes_.begin(), block_max_sizes_.end());
 	}
 
-private:
-	void initVertexBuffer()
+	// moving only the objects whose cell changed since the last build or update. needs reserve_slack
+	void update(const float* positions_x, const float* positions_y, const size_t object_count, tp::ThreadPool& thread_pool)
 	{
-		std::vector<sf::Vertex> vertices(static_cast<std::vector<sf::Vertex>::size_type>((CellsX + CellsY) * 2));
+		const uint32_t thread_count = thread_pool.m_thread_count;
+		const size_t objects_per_thread = object_count / thread_count;
+		const uint32_t cells_per_thread = static_cast<uint32_t>(total_cells) / thread_count;
+		movers_.resize(thread_count);
+		spilled_.resize(thread_count);
+
+		// finding the movers. their new cell is stored straight away and the cell they left is marked dirty
+		thread_pool.parallel([this, thread_count, objects_per_thread, object_count, positions_x, positions_y](const uint32_t t) {
+			std::vector<obj_idx>& movers = movers_[t];
+			movers.clear();
+
+			const size_t start = t * objects_per_thread;
+			const size_t end = (t == thread_count - 1) ? object_count : start + objects_per_thread;
+			for (size_t i = start; i < end; ++i)
+			{
+				const cell_idx index = hash(positions_x[i], positions_y[i]);
+				if (index != cell_of[i])
+				{
+					std::atomic_ref<uint8_t>(cell_dirty_[cell_of[i]]).store(1, std::memory_order_relaxed);
+					cell_of[i] = index;
+					movers.push_back(static_cast<obj_idx>(i));
+				}
+			}
+			});
 
-		vertexBuffer = sf::VertexBuffer(sf::Lines, sf::VertexBuffer::Static);
-		vertexBuffer.create(vertices.size());
+		// every thread compacts the dirty cells in its own range, dropping the objects which now belong elsewhere
+		thread_pool.parallel([this, thread_count, cells_per_thread](const uint32_t t) {
+			const uint32_t start = t * cells_per_thread;
+			const uint32_t end = (t == thread_count - 1) ? static_cast<uint32_t>(total_cells) : start + cells_per_thread;
+			for (uint32_t idx = start; idx < end; ++idx)
+			{
+				if (!cell_dirty_[idx])
+				{
+					continue;
+				}
+
+				cell_dirty_[idx] = 0;
+				obj_idx* contents = objects.data() + cell_start[idx];
+				uint32_t kept = 0;
+				for (uint32_t slot = 0; slot < objects_count[idx]; ++slot)
+				{
+					if (cell_of[contents[slot]] == idx)
+					{
+						contents[kept++] = contents[slot];
+					}
+				}
+				objects_count[idx] = kept;
+			}
+			});
 
-		size_t counter = 0;
-		for (size_t x = 0; x < CellsX; x++)
+		// movers reserve a slot in their new cell with an atomic increment. if the cell is full the slot is remembered instead
+		if (stable_order)
+		{
+			// one thread going through the movers in index order, the threads' lists are ascending and follow each other
+			for (uint32_t t = 0; t < thread_count; ++t)
+			{
+				insert_movers(t);
+			}
+		}
+		else
 		{
-			const float posX = static_cast<float>(x) * m_cellSize.x;
-			vertices[counter].position = { posX, 0 };
-			vertices[counter + 1].position = { m_screenSize.left + posX, m_screenSize.top + m_screenSize.height };
-			counter += 2;
+			thread_pool.parallel([this](const uint32_t t) { insert_movers(t); });
 		}
 
-		for (size_t y = 0; y < CellsY; y++)
+		const bool any_spilled = std::any_of(spilled_.begin(), spilled_.end(), [](const auto& spilled) { return !spilled.empty(); });
+		if (any_spilled)
 		{
-			const float posY = static_cast<float>(y) * m_cellSize.y;
-			vertices[counter].position = { 0, posY };
-			vertices[counter + 1].position = { m_screenSize.left + m_screenSize.width, m_screenSize.top + posY };
-			counter += 2;
+			relayout(thread_pool);
 		}
+	}
 
-		for (size_t x = 0; x < counter; x++)
+	// the objects in cell order without the spare slots, and where each cell starts in that order (sorted_start)
+	void cell_order(std::vector<obj_idx>& order, tp::ThreadPool& thread_pool)
+	{
+		sorted_start.resize(total_cells + 1);
+		uint32_t running_total = 0;
+		for (size_t idx = 0; idx < total_cells; ++idx)
 		{
-			vertices[x].color = { 75, 75, 75 };
+			sorted_start[idx] = running_total;
+			running_total += objects_count[idx];
 		}
+		sorted_start[total_cells] = running_total;
+		order.resize(running_total);
 
-		vertexBuffer.update(vertices.data(), vertices.size(), 0);
+		thread_pool.dispatch(static_cast<uint32_t>(total_cells), [this, &order](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t idx = start; idx < end; ++idx)
+			{
+				std::copy_n(cell_contents(idx), objects_count[idx], order.data() + sorted_start[idx]);
+			}
+		});
 	}
 
-	void initFont()
+	// called once the objects themselves have been permuted into cell_order(), so the objects of a cell are numbered consecutively
+	void relabel_in_cell_order(tp::ThreadPool& thread_pool)
 	{
-		constexpr int char_size = 45;
-		const std::string font_location = "fonts/Calibri.ttf";
-		if (!font.loadFromFile(font_location))
+		thread_pool.dispatch(static_cast<uint32_t>(total_cells), [this](const uint32_t start, const uint32_t end)
 		{
-			std::cerr << "[ERROR]: Failed to load font from: " << font_location << '\n';
-			return;
-		}
-		text = sf::Text("", font, char_size);
+			for (uint32_t idx = start; idx < end; ++idx)
+			{
+				for (uint32_t slot = 0; slot < objects_count[idx]; ++slot)
+				{
+					const obj_idx object = sorted_start[idx] + slot;
+					objects[cell_start[idx] + slot] = object;
+					cell_of[object] = idx;
+				}
+			}
+		});
 	}
 
-	void init_graphics()
+	// the objects in a cell, objects_count[cell_index] long
+	inline const obj_idx* cell_contents(const cell_idx cell_index) const
 	{
-		// increasing the size of the boundaries very slightly stops any out-of-range errors 
-		constexpr float resize = 1.f;
-		m_screenSize.left -= resize;
-		m_screenSize.top -= resize;
-		m_screenSize.width += resize;
-		m_screenSize.height += resize;
+		return objects.data() + cell_start[cell_index];
+	}
 
-		m_cellSize = { m_screenSize.width / static_cast<float>(CellsX),
-						  m_screenSize.height / static_cast<float>(CellsY) };
+	inline void clear()
+	{
+		std::fill(objects_count.begin(), objects_count.end(), 0);
+	}
 
+	// the number of slots given to a cell holding `count` objects
+	inline uint32_t cell_capacity(const uint32_t count) const
+	{
+		return reserve_slack ? count + count / 2 + 4 : count;
 	}
 
 
 public:
-	inline static constexpr size_t total_cells = CellsX * CellsY;
+	uint32_t cells_x = 0;
+	uint32_t cells_y = 0;
+	size_t total_cells = 0;
+
+	// the size of a cell, and of the area the cells cover
+	GridExtent m_cellSize{};
+	GridExtent m_worldSize{};
+
+	// compressed-sparse-row storage. the objects of cell c are objects[cell_start[c] .. cell_start[c] + objects_count[c]),
+	// the slots up to cell_start[c + 1] are spare
+	AlignedVector<obj_idx> objects{};
+	AlignedVector<uint32_t> cell_start{};
+	AlignedVector<uint32_t> objects_count{};
+
+	// where each cell starts once the objects are numbered in cell order, see cell_order()
+	std::vector<uint32_t> sorted_start{};
+
+	// the cell each object is currently stored in
+	AlignedVector<cell_idx> cell_of{};
+
+	// the most slots held by a single cell, no cell can hold more objects until the next build. used to size neighbour buffers
+	uint32_t max_cell_size = 0;
+
+	// spare slots are reserved in every cell so update() can be used between builds
+	bool reserve_slack = false;
+
+	// update() inserts the objects which changed cell on one thread, so the order inside every cell never depends on the
+	// thread count or on scheduling. build() is always stable
+	bool stable_order = false;
+
+	// how many objects the cells of the last build hold, equal to the object count unless one was left out or counted twice
+	std::atomic<uint32_t> inserted_count = 0;
+
+private:
+	// the build on a single thread, a plain counting sort. handing the objects to the owner of their cells would only copy
+	// every index once more
+	void build_serial(const float* positions_x, const float* positions_y, const size_t object_count)
+	{
+		std::fill(objects_count.begin(), objects_count.end(), 0);
+		for (size_t i = 0; i < object_count; ++i)
+		{
+			const cell_idx index = hash(positions_x[i], positions_y[i]);
+			cell_of[i] = index;
+			if (index < total_cells)
+			{
+				++objects_count[index];
+			}
+		}
+
+		uint32_t running_total = 0;
+		uint32_t inserted = 0;
+		max_cell_size = 0;
+		for (size_t idx = 0; idx < total_cells; ++idx)
+		{
+			const uint32_t capacity = cell_capacity(objects_count[idx]);
+			cell_start[idx] = running_total;
+			cell_cursor_[idx] = running_total;
+			running_total += capacity;
+			max_cell_size = std::max(max_cell_size, capacity);
+			inserted += objects_count[idx];
+		}
+		cell_start[total_cells] = running_total;
+		objects.resize(running_total);
+		cell_dirty_.assign(total_cells, 0);
+
+		for (size_t i = 0; i < object_count; ++i)
+		{
+			if (cell_of[i] < total_cells)
+			{
+				objects[cell_cursor_[cell_of[i]]++] = static_cast<obj_idx>(i);
+			}
+		}
+		inserted_count = inserted;
+	}
+
+	void insert_movers(const uint32_t t)
+	{
+		std::vector<std::pair<obj_idx, uint32_t>>& spilled = spilled_[t];
+		spilled.clear();
 
-	// graphics
-	sf::Vector2f m_cellSize{};
-	sf::FloatRect m_screenSize{};
+		for (const obj_idx object : movers_[t])
+		{
+			const cell_idx index = cell_of[object];
+			const uint32_t slot = std::atomic_ref<uint32_t>(objects_count[index]).fetch_add(1, std::memory_order_relaxed);
+
+			if (cell_start[index] + slot < cell_start[index + 1])
+			{
+				objects[cell_start[index] + slot] = object;
+			}
+			else
+			{
+				spilled.emplace_back(object, slot);
+			}
+		}
+	}
 
-	sf::VertexBuffer vertexBuffer{};
-	sf::Font font;
-	sf::Text text;
+	void relayout(tp::ThreadPool& thread_pool)
+	{
+		// objects_count already includes the spilled movers. every cell is given fresh slack and moved to its new start,
+		// then the spilled movers are written to the slot they reserved
+		new_cell_start_.resize(total_cells + 1);
+		uint32_t running_total = 0;
+		max_cell_size = 0;
+		for (size_t idx = 0; idx < total_cells; ++idx)
+		{
+			new_cell_start_[idx] = running_total;
+			const uint32_t capacity = cell_capacity(objects_count[idx]);
+			running_total += capacity;
+			max_cell_size = std::max(max_cell_size, capacity);
+		}
+		new_cell_start_[total_cells] = running_total;
+		new_objects_.resize(running_total);
+
+		thread_pool.dispatch(static_cast<uint32_t>(total_cells), [this](const uint32_t start, const uint32_t end)
+		{
+			for (uint32_t idx = start; idx < end; ++idx)
+			{
+				const uint32_t stored = std::min(objects_count[idx], cell_start[idx + 1] - cell_start[idx]);
+				std::copy_n(objects.data() + cell_start[idx], stored, new_objects_.data() + new_cell_start_[idx]);
+			}
+		});
+
+		for (const auto& spilled : spilled_)
+		{
+			for (const auto& [object, slot] : spilled)
+			{
+				new_objects_[new_cell_start_[cell_of[object]] + slot] = object;
+			}
+		}
+
+		objects.swap(new_objects_);
+		cell_start.swap(new_cell_start_);
+	}
 
-	alignas(32) std::vector<std::array<obj_idx, cell_capacity>> grid{};
-	alignas(32) std::vector<uint8_t> objects_count{};
+	// build: how many objects every thread found for every thread's block of cells, turned into staging slots, the objects
+	// grouped by the block of their cell, and the next free slot of every cell during the scatter
+	std::vector<uint32_t> block_counts_{};
+	AlignedVector<obj_idx> staged_{};
+	std::vector<uint32_t> cell_cursor_{};
+	std::vector<uint32_t> block_totals_{};
+	std::vector<uint32_t> block_max_sizes_{};
+
+	// incremental updates: the objects that changed cell, one list per thread, and the cells they left
+	std::vector<std::vector<obj_idx>> movers_{};
+	std::vector<uint8_t> cell_dirty_{};
+
+	// movers which found their new cell full, with the slot they reserved
+	std::vector<std::vector<std::pair<obj_idx, uint32_t>>> spilled_{};
+	AlignedVector<obj_idx> new_objects_{};
+	AlignedVector<uint32_t> new_cell_start_{};
 };
\ No newline at end of file
@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#endif
+
+namespace tp
+{
+    // - where a thread is running: the logical cpu, and the numa node it belongs to.
+    // - on a machine with several sockets every socket has its own memory controller, a node. memory attached to another
+    //   node is reached over the interconnect between the sockets, with higher latency and less bandwidth.
+    // - -1 when the system does not say.
+    struct Placement
+    {
+        int cpu = -1;
+        int node = -1;
+    };
+
+
+    // the numa node a logical cpu belongs to, 0 when the system has no numa information
+    inline int cpuNode(const int cpu)
+    {
+#if defined(_WIN32)
+        UCHAR node = 0;
+        return cpu < 64 && GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node) ? static_cast<int>(node) : 0;
+#elif defined(__linux__)
+        // every node lists its cpus as ranges, e.g. "0-7,16-23"
+        for (int node = 0; ; ++node)
+        {
+            std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!cpulist)
+            {
+                return 0;
+            }
+
+            std::string range;
+            while (std::getline(cpulist, range, ','))
+            {
+                int first = -1;
+                int last = -1;
+                char dash = 0;
+                std::istringstream parser(range);
+                parser >> first;
+                last = (parser >> dash >> last) ? last : first;
+                if (cpu >= first && cpu <= last)
+                {
+                    return node;
+                }
+            }
+        }
+#else
+        return 0;
+#endif
+    }
+
+
+    // - the logical cpus the process may run on, interleaved across the numa nodes: the first cpu of every node, then the
+    //   second of every node and so on.
+    // - consecutive workers then alternate between the sockets, and a pool smaller than the machine uses the memory
+    //   bandwidth of all of them rather than filling one socket first.
+    inline std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+#if defined(_WIN32)
+        DWORD_PTR process_mask = 0;
+        DWORD_PTR system_mask = 0;
+        if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+        {
+            for (int cpu = 0; cpu < static_cast<int>(sizeof(DWORD_PTR) * 8); ++cpu)
+            {
+                if (process_mask & (static_cast<DWORD_PTR>(1) << cpu))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+
+        // stable sort by how many cpus of the same node came before, then by node
+        std::vector<std::pair<int, int>> keys(cpus.size());
+        std::vector<int> seen_per_node;
+        for (size_t i = 0; i < cpus.size(); ++i)
+        {
+            const int node = cpuNode(cpus[i]);
+            seen_per_node.resize(std::max<size_t>(seen_per_node.size(), static_cast<size_t>(node) + 1), 0);
+            keys[i] = { seen_per_node[node]++, node };
+        }
+
+        std::vector<size_t> order(cpus.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&keys](const size_t a, const size_t b) { return keys[a] < keys[b]; });
+
+        std::vector<int> interleaved;
+        interleaved.reserve(cpus.size());
+        for (const size_t i : order)
+        {
+            interleaved.push_back(cpus[i]);
+        }
+        return interleaved;
+    }
+
+
+    // restricting a thread to a single logical cpu, so the scheduler can no longer move it away from the memory it touched
+    inline bool pinThread(std::thread::native_handle_type handle, const int cpu)
+    {
+#if defined(_WIN32)
+        return cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)
+            && SetThreadAffinityMask(static_cast<HANDLE>(handle), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    inline bool pinCurrentThread(const int cpu)
+    {
+#if defined(_WIN32)
+        return cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)
+            && SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#elif defined(__linux__)
+        return pinThread(pthread_self(), cpu);
+#else
+        return false;
+#endif
+    }
+
+
+    // the cpu and node the calling thread is running on at this moment
+    inline Placement currentPlacement()
+    {
+        Placement placement;
+#if defined(_WIN32)
+        PROCESSOR_NUMBER processor{};
+        GetCurrentProcessorNumberEx(&processor);
+        USHORT node = 0;
+        placement.cpu = processor.Group * 64 + processor.Number;
+        placement.node = GetNumaProcessorNodeEx(&processor, &node) ? static_cast<int>(node) : -1;
+#elif defined(__linux__)
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+        {
+            placement.cpu = static_cast<int>(cpu);
+            placement.node = static_cast<int>(node);
+        }
+#endif
+        return placement;
+    }
+
+
+    // - hands whole pages of an array back to the os, they read as zero from then on. the next write to one of them
+    //   allocates a fresh page on the numa node of the writing thread.
+    // - the pages at either end that are shared with other allocations are kept. false when nothing was released.
+    inline bool releasePages(void* data, const size_t bytes)
+    {
+#if defined(__linux__)
+        const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        const auto begin = (reinterpret_cast<uintptr_t>(data) + page_size - 1) & ~(page_size - 1);
+        const auto end = (reinterpret_cast<uintptr_t>(data) + bytes) & ~(page_size - 1);
+        return end > begin && madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED) == 0;
+#else
+        // windows has no way to drop the contents of a heap page, MEM_RESET leaves them undefined rather than zero
+        (void)data;
+        (void)bytes;
+        return false;
+#endif
+    }
+}
@@ -1,14 +1,70 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <queue>
 #include <vector>
 #include <thread>
 #include <mutex>
 #include <atomic>
-#include <condition_variable>
+#include <type_traits>
+
+#include "thread_placement.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 namespace tp
 {
+    // - a hint to the cpu that this is a spin-wait loop. on x86 the pause instruction stops the spinning core from flooding
+    //   the memory system with speculative loads and lets a hyper-threaded sibling run in the meantime.
+    inline void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        _mm_pause();
+#endif
+    }
+
+
+    // - idle workers wait on this counter. whoever has new work for them (a task, a parallel region, or the stop) bumps it,
+    //   so a worker that read the old value before looking for work can never miss what arrived after it looked.
+    // - waiting spins for a while before parking the thread: the next phase of a step usually starts within microseconds,
+    //   and waking a parked thread costs a system call and a trip through the scheduler.
+    struct WakeSignal
+    {
+        std::atomic<uint32_t> m_generation = 0;
+
+        uint32_t current() const
+        {
+            return m_generation.load(std::memory_order_acquire);
+        }
+
+        void notify()
+        {
+            m_generation.fetch_add(1, std::memory_order_release);
+            m_generation.notify_all();
+        }
+
+        void waitPast(const uint32_t seen, const uint32_t spin_count) const
+        {
+            for (uint32_t i{ 0 }; i < spin_count; ++i)
+            {
+                if (current() != seen)
+                {
+                    return;
+                }
+                cpuRelax();
+            }
+
+            // std::atomic::wait parks the thread until the value is no longer `seen` (a futex on linux, WaitOnAddress on windows)
+            m_generation.wait(seen, std::memory_order_acquire);
+        }
+    };
+
+
     // - responsible for managing the tasks to be executed by the thread pool.
     // - uses a std::queue to store the tasks.
     // - Uses synchronization primitives (coordinates the execution of multiple threads & prevent race conditions) 
@@ -25,21 +81,14 @@ namespace tp
         // - After finishing with the shared resource, the thread "unlocks" the mutex, allowing other threads to acquire it.
         std::mutex                        m_mutex;
 
-        // - A synchronization primitive that enables threads to wait for a specific condition to occur.
-        // - A thread locks a mutex and checks if a condition is met.
-        // - If the condition is not met, it calls wait() on the condition variable, which atomically releases the mutex and puts the thread to sleep.
-        // - When another thread changes the condition, it calls notify_one() or notify_all() on the condition variable.
-        // - The waiting thread(s) wake up, reacquire the mutex, and check the condition again.
-        std::condition_variable           m_condition_variable; // Used to notify worker threads when new tasks are available.
-
         // - std::atomic provides atomic operations on an enclosed value, ensuring that these operations are indivisible 
         //   and free from race conditions without needing explicit locking.
         // - used to keep track of the number of remaining tasks without risking data races when multiple threads increment or decrement it.
         std::atomic<uint32_t>             m_remaining_tasks = 0;
 
-        bool                              m_stop = false; // flag for when the queue should stop operating
+        std::atomic<bool>                 m_stop = false; // flag for when the queue should stop operating
 
-        // Adds a new task to the queue and notifies waiting threads
+        // Adds a new task to the queue. the pool wakes the workers up afterwards
         template<typename TCallback>
         void addTask(TCallback&& callback)
         {
@@ -52,20 +101,19 @@ namespace tp
                 m_tasks.push(std::forward<TCallback>(callback));
                 m_remaining_tasks++;
             }
-
-            // Wakes up one waiting thread
-            // Used when a shared state protected by a mutex is modified and only one waiting thread needs to be notified of this change
-            // used to wake up a worker thread when a new task is added to the queue.
-            m_condition_variable.notify_one();
         }
 
-        // Retrieves a task from the queue, waiting if necessary.
-        bool getTask(std::function<void()>& target_callback)
+        // Retrieves a task from the queue if there is one. idle workers wait on the pool's WakeSignal rather than in here
+        bool tryGetTask(std::function<void()>& target_callback)
         {
-            // unique_lock is used here to protect access to shared data (the task queue) and work with the condition variable.
+            // the remaining count is checked first, so an idle look at an empty queue does not take the lock
+            if (m_remaining_tasks.load(std::memory_order_acquire) == 0)
+            {
+                return false;
+            }
+
+            // unique_lock is used here to protect access to shared data (the task queue)
             std::unique_lock<std::mutex> lock_guard{ m_mutex };
-            m_condition_variable.wait(lock_guard, [this]() { return !m_tasks.empty() || m_stop; });
-            
             if (m_tasks.empty()) 
             {
                 return false;
@@ -78,13 +126,38 @@ namespace tp
             return true;
         }
 
-        // waits until all tasks are completed
-        void waitForCompletion() const
+        // runs one task from the queue on the calling thread, false when the queue was empty
+        bool runTask(std::function<void()>& task)
         {
+            if (!tryGetTask(task))
+            {
+                return false;
+            }
+
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                // Handle task exceptions here if needed
+            }
+            workDone();
+            task = nullptr;
+            return true;
+        }
+
+        // waits until all tasks are completed. the waiting thread runs queued tasks itself in the meantime
+        void waitForCompletion()
+        {
+            std::function<void()> task = nullptr;
             while (m_remaining_tasks > 0) 
             {
-                // allowing other threads to run while waiting for tasks to complete.
-                std::this_thread::yield();
+                if (!runTask(task))
+                {
+                    // allowing other threads to run while the last tasks complete.
+                    std::this_thread::yield();
+                }
             }
         }
 
@@ -94,20 +167,139 @@ namespace tp
             m_remaining_tasks--;
         }
 
-        // Signals the queue to stop operating
+        // Signals the queue to stop operating. the pool wakes the workers up afterwards
         void stop()
         {
+            m_stop = true;
+        }
+    };
+
+
+    // - a parallel region: one callback run by every worker at once, with the worker's index. the thread starting the
+    //   region runs index 0 itself, the pool's threads run the others.
+    // - the callback is passed by address with a plain function pointer to call it, nothing is allocated or copied per region.
+    // - the region ends in a spin-then-park barrier: the starting thread waits until every worker has finished its share.
+    struct ParallelRegion
+    {
+        void (*m_function)(void*, uint32_t) = nullptr;
+        void* m_context = nullptr;
+
+        std::atomic<uint32_t> m_epoch = 0;   // bumped when a region starts, every worker runs each region once
+        std::atomic<uint32_t> m_pending = 0; // the pool threads that have not finished their share yet
+
+        void runShare(const uint32_t worker)
+        {
+            try
             {
-                std::lock_guard<std::mutex> lock_guard{ m_mutex };
-                m_stop = true;
+                m_function(m_context, worker);
+            }
+            catch (...)
+            {
+                // Handle task exceptions here if needed
+            }
+
+            // the last one out wakes the starting thread if it parked
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                m_pending.notify_one();
+            }
+        }
+
+        void join(const uint32_t spin_count) const
+        {
+            for (uint32_t i{ 0 }; i < spin_count; ++i)
+            {
+                if (m_pending.load(std::memory_order_acquire) == 0)
+                {
+                    return;
+                }
+                cpuRelax();
+            }
+
+            uint32_t pending = m_pending.load(std::memory_order_acquire);
+            while (pending != 0)
+            {
+                m_pending.wait(pending, std::memory_order_acquire);
+                pending = m_pending.load(std::memory_order_acquire);
+            }
+        }
+    };
+
+    // - one worker's share of a stealing dispatch, a range of indices packed into a single 64-bit word (begin low, end high)
+    //   so both ends can be moved together with one compare-and-swap.
+    // - it works like a deque: the owner claims chunks from the front, idle workers steal the back half. nobody ever takes a lock,
+    //   a failed compare-and-swap just means someone else moved the range first and the attempt is repeated on the new value.
+    // - aligned to a cache line so the owners claiming from neighbouring ranges do not invalidate each other's line.
+    struct alignas(64) StealableRange
+    {
+        std::atomic<uint64_t> m_range = 0;
+
+        static uint64_t pack(const uint32_t begin, const uint32_t end)
+        {
+            return (static_cast<uint64_t>(end) << 32) | begin;
+        }
+
+        static uint32_t beginOf(const uint64_t range) { return static_cast<uint32_t>(range); }
+        static uint32_t endOf(const uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+
+        uint32_t remaining() const
+        {
+            const uint64_t range = m_range.load(std::memory_order_relaxed);
+            return beginOf(range) < endOf(range) ? endOf(range) - beginOf(range) : 0;
+        }
+
+        // only called while nobody else can steal a non-empty range from here: before the dispatch starts, or by the owner while it is empty
+        void reset(const uint32_t begin, const uint32_t end)
+        {
+            m_range.store(pack(begin, end), std::memory_order_release);
+        }
+
+        // the owner's side, up to `grain` indices from the front
+        bool claimFront(const uint32_t grain, uint32_t& begin, uint32_t& end)
+        {
+            uint64_t range = m_range.load(std::memory_order_acquire);
+            while (beginOf(range) < endOf(range))
+            {
+                const uint32_t claimed_end = endOf(range) - beginOf(range) > grain ? beginOf(range) + grain : endOf(range);
+                if (m_range.compare_exchange_weak(range, pack(claimed_end, endOf(range)), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    begin = beginOf(range);
+                    end = claimed_end;
+                    return true;
+                }
             }
+            return false;
+        }
 
-            // Wakes up all waiting threads. It's used when multiple threads might be waiting and all need to check a condition.
-            // Wake up all worker threads when the thread pool is being shut down.
-            m_condition_variable.notify_all();
+        // a thief's side, the back half of what is left as long as at least `min_size` is left
+        bool stealBack(const uint32_t min_size, uint32_t& begin, uint32_t& end)
+        {
+            uint64_t range = m_range.load(std::memory_order_acquire);
+            while (beginOf(range) < endOf(range) && endOf(range) - beginOf(range) >= min_size)
+            {
+                const uint32_t middle = beginOf(range) + (endOf(range) - beginOf(range)) / 2;
+                if (m_range.compare_exchange_weak(range, pack(beginOf(range), middle), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    begin = middle;
+                    end = endOf(range);
+                    return true;
+                }
+            }
+            return false;
         }
     };
 
+
+    // - what one worker did during the last stealing dispatch: how long it spent running chunks and looking for more, and how
+    //   many chunks it ran. the spread of the busy times shows how well the work was balanced.
+    // - aligned to a cache line, every worker only writes its own.
+    struct alignas(64) WorkerTelemetry
+    {
+        uint64_t m_busy_ns = 0;
+        uint32_t m_chunks = 0;
+    };
+
+
     // A thread that executes tasks from the TaskQueue.
     struct Worker
     {
@@ -118,41 +310,54 @@ namespace tp
         // - void() specifies that it wraps a function taking no arguments and returning nothing.
         std::function<void()> m_task = nullptr; // The current task being executed.
         TaskQueue* m_queue = nullptr; // pointer for fetching tasks
+        ParallelRegion* m_region = nullptr;
+        WakeSignal* m_wake = nullptr;
+        uint32_t m_spin_count = 0;
+        uint32_t m_region_seen = 0; // the last region this worker ran its share of
 
         Worker() = default;
 
-        Worker(TaskQueue& queue, uint32_t id)
+        Worker(TaskQueue& queue, ParallelRegion& region, WakeSignal& wake, uint32_t id, uint32_t spin_count)
             : m_id{ id }
             , m_queue{ &queue }
+            , m_region{ &region }
+            , m_wake{ &wake }
+            , m_spin_count{ spin_count }
+            , m_region_seen{ region.m_epoch.load(std::memory_order_relaxed) } // read here, a region may start before the thread does
         {
             m_thread = std::thread([this]() {
                 run();
                 });
         }
 
-        // continuously fetching and executing tasks.
+        // continuously running parallel regions and tasks, and waiting on the wake signal when there are none.
+        // the thread persists for the lifetime of the pool, nothing is created or destroyed per phase
         void run()
         {
             while (true) 
             {
-                if (!m_queue->getTask(m_task)) 
+                const uint32_t seen = m_wake->current();
+
+                const uint32_t epoch = m_region->m_epoch.load(std::memory_order_acquire);
+                if (epoch != m_region_seen)
                 {
-                    break;
+                    // index 0 is the thread that started the region
+                    m_region_seen = epoch;
+                    m_region->runShare(m_id + 1);
+                    continue;
                 }
 
-                if (m_task) 
+                if (m_queue->runTask(m_task))
                 {
-                    try 
-                    {
-                        m_task();
-                    }
-                    catch (...) 
-                    {
-                        // Handle task exceptions here if needed
-                    }
-                    m_queue->workDone();
-                    m_task = nullptr;
+                    continue;
                 }
+
+                if (m_queue->m_stop)
+                {
+                    break;
+                }
+
+                m_wake->waitPast(seen, m_spin_count);
             }
         }
 
@@ -170,25 +375,44 @@ namespace tp
     // manages a collection of Worker threads and provides the main interface
     struct ThreadPool
     {
-        uint32_t            m_thread_count = 0;
+        // spins before parking. how long a wait is spun for, about 10-50 microseconds depending on the cpu's pause latency
+        inline static constexpr uint32_t spin_count = 1u << 11;
+
+        uint32_t            m_thread_count = 0; // the workers of a parallel region, the calling thread included
+        uint32_t            m_spin_count = 0;
+        WakeSignal          m_wake;
         TaskQueue           m_queue; // The Task Queue shared by all workers
+        ParallelRegion      m_region;
         std::vector<Worker> m_workers;
 
-        // Initializes Self, Task Queue, and worker threads
+        // one range per worker for dispatchStealing(), how many ranges were stolen during the last one and what each worker did
+        std::unique_ptr<StealableRange[]>  m_ranges;
+        std::atomic<uint32_t>              m_steal_count = 0;
+        std::unique_ptr<WorkerTelemetry[]> m_telemetry;
+
+        // the cpu every worker was pinned to by pinThreads(), the calling thread first. empty while not pinned
+        std::vector<int> m_pinned_cpus;
+
+        // Initializes Self, Task Queue, and worker threads. the calling thread takes a share of every region, so one thread
+        // fewer is started. with more threads than cores a spinning thread would only hold up the one it waits for, so they never spin
         explicit ThreadPool(uint32_t thread_count)
-            : m_thread_count{ thread_count }
+            : m_thread_count{ std::max(thread_count, 1u) }
+            , m_spin_count{ m_thread_count <= std::max(std::thread::hardware_concurrency(), 1u) ? spin_count : 0u }
+            , m_ranges{ std::make_unique<StealableRange[]>(m_thread_count) }
+            , m_telemetry{ std::make_unique<WorkerTelemetry[]>(m_thread_count) }
         {
-            m_workers.reserve(thread_count);
+            m_workers.reserve(m_thread_count - 1);
             
-            for (uint32_t i{ thread_count }; i--;) 
+            for (uint32_t i{ m_thread_count - 1 }; i--;) 
             {
-                m_workers.emplace_back(m_queue, static_cast<uint32_t>(m_workers.size()));
+                m_workers.emplace_back(m_queue, m_region, m_wake, static_cast<uint32_t>(m_workers.size()), m_spin_count);
             }
         }
 
         ~ThreadPool()
         {
             m_queue.stop();
+            m_wake.notify();
 
             for (Worker& worker : m_workers) 
             {
@@ -201,34 +425,188 @@ namespace tp
         void addTask(TCallback&& callback)
         {
             m_queue.addTask(std::forward<TCallback>(callback));
+            m_wake.notify();
         }
 
         // waits for all tasks to complete
-        void waitForCompletion() const
+        void waitForCompletion()
         {
             m_queue.waitForCompletion();
         }
 
-        // Distributes work across the thread pool
+        // - runs callback(worker) once for every worker in [0, m_thread_count) at the same time and returns when all have finished.
+        // - the calling thread is worker 0. the pool's threads are woken through the wake signal, nothing is queued or allocated,
+        //   so starting and joining a region costs microseconds where queueing a task per thread cost a lock and a wake-up each.
+        // - regions do not nest, and the callback must not start one itself.
+        template<typename TCallback>
+        void parallel(TCallback&& callback)
+        {
+            using Callback = std::remove_reference_t<TCallback>;
+
+            if (m_workers.empty())
+            {
+                callback(0u);
+                return;
+            }
+
+            m_region.m_function = [](void* context, const uint32_t worker) { (*static_cast<Callback*>(context))(worker); };
+            m_region.m_context = const_cast<void*>(static_cast<const void*>(std::addressof(callback)));
+            m_region.m_pending.store(static_cast<uint32_t>(m_workers.size()), std::memory_order_relaxed);
+            m_region.m_epoch.fetch_add(1, std::memory_order_release);
+            m_wake.notify();
+
+            callback(0u);
+            m_region.join(m_spin_count);
+        }
+
+        // - pins every worker to its own logical cpu, the calling thread (worker 0) included, interleaved across the numa nodes.
+        // - a pinned worker stays next to the memory it first touched, see firstTouch(). does nothing and returns false when
+        //   the process may use fewer cpus than there are workers, sharing cpus would only make workers wait on each other.
+        bool pinThreads()
+        {
+            const std::vector<int> cpus = allowedCpus();
+            if (cpus.size() < m_thread_count)
+            {
+                return false;
+            }
+
+            bool pinned = pinCurrentThread(cpus[0]);
+            for (Worker& worker : m_workers)
+            {
+                pinned &= pinThread(worker.m_thread.native_handle(), cpus[worker.m_id + 1]);
+            }
+
+            m_pinned_cpus.assign(cpus.begin(), cpus.begin() + m_thread_count);
+            return pinned;
+        }
+
+        // where every worker is running, each one asked from inside a parallel region. unpinned workers may have moved by the time it returns
+        std::vector<Placement> placement()
+        {
+            std::vector<Placement> placements(m_thread_count);
+            parallel([&placements](const uint32_t worker) {
+                placements[worker] = currentPlacement();
+            });
+            return placements;
+        }
+
+        // Distributes work across the thread pool, the last batch also takes the rest
         template<typename TCallback>
         void dispatch(uint32_t element_count, TCallback&& callback)
         {
             const uint32_t batch_size = element_count / m_thread_count;
-            for (uint32_t i{ 0 }; i < m_thread_count; ++i) 
-            {
+            parallel([this, batch_size, element_count, &callback](const uint32_t i) {
                 const uint32_t start = batch_size * i;
-                const uint32_t end = start + batch_size;
-                addTask([start, end, &callback]() { callback(start, end); });
-            }
+                const uint32_t end = (i == m_thread_count - 1) ? element_count : start + batch_size;
+                callback(start, end);
+            });
+        }
 
-            if (batch_size * m_thread_count < element_count) 
+        // - distributes [0, element_count) like dispatch(), but the work is rebalanced while it runs: every worker claims `grain`
+        //   indices at a time from its own range, and once that runs dry it steals the back half of the fullest range left.
+        // - for work whose cost per index is uneven, the step no longer waits for the slowest static slice.
+        // - callback(start, end, worker) runs once per claimed chunk. `worker` is the same for every chunk a task runs, so
+        //   per-worker scratch buffers stay private to one thread.
+        // - `splits` optionally holds m_thread_count + 1 ascending bounds to start the ranges from, so a caller who can estimate
+        //   the cost of its elements hands out equal costs rather than equal counts. equal batches when null.
+        // - a grain of element_count or more turns the stealing off, every worker runs its starting range in one go.
+        template<typename TCallback>
+        void dispatchStealing(uint32_t element_count, uint32_t grain, TCallback&& callback, const uint32_t* splits = nullptr)
+        {
+            grain = std::max(grain, 1u);
+            const uint32_t batch_size = element_count / m_thread_count;
+            for (uint32_t i{ 0 }; i < m_thread_count; ++i)
             {
-                const uint32_t start = batch_size * m_thread_count;
-                callback(start, element_count);
+                if (splits)
+                {
+                    m_ranges[i].reset(splits[i], splits[i + 1]);
+                }
+                else
+                {
+                    m_ranges[i].reset(batch_size * i, (i == m_thread_count - 1) ? element_count : batch_size * (i + 1));
+                }
             }
+            m_steal_count = 0;
+
+            parallel([this, grain, &callback](const uint32_t i) {
+                const auto started = std::chrono::steady_clock::now();
+                uint32_t chunks = 0;
+                uint32_t start = 0;
+                uint32_t end = 0;
+                do
+                {
+                    while (m_ranges[i].claimFront(grain, start, end))
+                    {
+                        callback(start, end, i);
+                        ++chunks;
+                    }
+                } while (stealInto(i, grain));
+
+                m_telemetry[i].m_busy_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - started).count());
+                m_telemetry[i].m_chunks = chunks;
+            });
+        }
+
+    private:
+        // refills the empty range of `thief` from the fullest other range. gives up once no range has two chunks left,
+        // the owners finish those sooner than a steal would pay off
+        bool stealInto(const uint32_t thief, const uint32_t grain)
+        {
+            while (true)
+            {
+                uint32_t victim = thief;
+                uint32_t most_remaining = 0;
+                for (uint32_t i{ 0 }; i < m_thread_count; ++i)
+                {
+                    const uint32_t remaining = m_ranges[i].remaining();
+                    if (i != thief && remaining > most_remaining)
+                    {
+                        victim = i;
+                        most_remaining = remaining;
+                    }
+                }
+
+                if (most_remaining < 2 * grain)
+                {
+                    return false;
+                }
 
-            waitForCompletion();
+                uint32_t start = 0;
+                uint32_t end = 0;
+                if (m_ranges[victim].stealBack(2 * grain, start, end))
+                {
+                    m_ranges[thief].reset(start, end);
+                    ++m_steal_count;
+                    return true;
+                }
+                // the victim moved on in the meantime, look again
+            }
         }
     };
 
+
+
+    // - the os places a page of memory on the numa node of the thread that first writes to it. std::vector zero-fills on
+    //   the thread that resizes it, so every page of a particle array ends up next to the main thread, and on a machine
+    //   with several sockets the workers on the others stream their share across the interconnect.
+    // - releases the pages of a freshly zeroed array and has every worker zero again the part dispatch() hands it, so each
+    //   page comes back on the node of the worker that processes it. the contents stay zero.
+    // - the partition only stays local for passes that split the array the same way. where pages cannot be released it does nothing
+    template<typename T, typename Allocator>
+    bool firstTouch(std::vector<T, Allocator>& array, ThreadPool& thread_pool)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "the released pages read as zero bytes");
+
+        if (!releasePages(array.data(), array.size() * sizeof(T)))
+        {
+            return false;
+        }
+
+        T* data = array.data();
+        thread_pool.dispatch(static_cast<uint32_t>(array.size()), [data](const uint32_t start, const uint32_t end) {
+            std::fill(data + start, data + end, T{});
+        });
+        return true;
+    }
 }